@@ -0,0 +1,272 @@
+/*
+ *  pgn2fen - Extracts FEN of a specific move on a PGN game
+ *  -------------------------------------------------------
+ *  Author: mate_amargo - Juan Alberto Regalado Galván
+ *  https://github.com/mate-amargo/pgn2fen
+ *  -------------------------------------------------------
+ *
+ *  Benchmarks. Each stage of reading a database is timed on its own: finding
+ *  the tokens, replaying the games, writing FENs, and replaying a binary
+ *  database. Then the pieces that make them up: playing a move of each kind,
+ *  from SAN and coded, and writing one FEN.
+ *
+ *  Usage: bench database.pgn
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../board.h"
+
+#define MINTIME 0.5      /* Seconds each benchmark runs at least, repeating it as needed */
+#define SAMPLES 4096     /* Moves of each kind kept for the move benchmarks */
+#define KINDS 8
+
+/* The moves we time on their own. Each goes through a different part of the move maker */
+static const char *kindnames[KINDS] = { "pawn", "knight", "bishop", "rook", "queen", "king", "castling", "promotion" };
+
+struct sample {
+  struct pgn2fen_position pos; /* Before the move */
+  char san[8];
+  int len;
+  pgn2fen_move move;
+};
+
+struct samples {
+  struct sample *moves[KINDS];
+  int count[KINDS];
+  struct pgn2fen_position *positions; /* Every position we sampled, for the FEN benchmark */
+  int npositions;
+};
+
+/* What a stage got through */
+struct totals {
+  size_t games, plies, tokens;
+};
+
+static const char *data;
+static size_t size;
+
+static double now (void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static int kind_of (const char *san, int len) {
+  if ('O' == san[0])
+    return 6;
+  if (memchr(san, '=', len))
+    return 7;
+  switch (san[0]) {
+    case 'N': return KNIGHT;
+    case 'B': return BISHOP;
+    case 'R': return ROOK;
+    case 'Q': return QUEEN;
+    case 'K': return KING;
+  }
+  return PAWN;
+}
+
+/* Stages. Each one goes once through the whole database */
+
+static void tokenize (struct totals *t) {
+  struct pgn2fen_input in;
+  const char *move;
+  size_t start;
+  int len, token;
+  pgn2fen_open_memory(data, size, &in);
+  while ((token = pgn2fen_read_token(&in, &move, &len, &start)) != PGN2FEN_TOKEN_EOF) {
+    t->tokens++;
+    if (PGN2FEN_TOKEN_TAG == token) /* Past the tag, the tokenizer leaves it to us */
+      while (in.pos < in.size && data[in.pos] != '\n')
+        in.pos++;
+    else if (PGN2FEN_TOKEN_RESULT == token)
+      t->games++;
+  }
+}
+
+/* Replay every game from "in", writing the FEN of every position if "fen" is set */
+static void replay_input (struct pgn2fen_input *in, int fen, struct totals *t) {
+  struct pgn2fen_game g;
+  char buf[PGN2FEN_FENSIZE];
+  int moved;
+  for (;;) {
+    pgn2fen_init_game(&g);
+    while ((moved = pgn2fen_next_move(in, &g, 1)) > 0) {
+      t->plies++;
+      if (fen)
+        pgn2fen_fen(&g.pos, buf, sizeof(buf));
+    }
+    if (!g.started)
+      break;
+    t->games++;
+    if (moved != 0)
+      pgn2fen_skip_game(in, &g);
+  }
+}
+
+static void replay (struct totals *t) {
+  struct pgn2fen_input in;
+  pgn2fen_open_memory(data, size, &in);
+  replay_input(&in, 0, t);
+}
+
+static void replay_fen (struct totals *t) {
+  struct pgn2fen_input in;
+  pgn2fen_open_memory(data, size, &in);
+  replay_input(&in, 1, t);
+}
+
+static const char *binarydata;
+static size_t binarysize;
+
+static void replay_binary (struct totals *t) {
+  struct pgn2fen_input in;
+  pgn2fen_open_memory(binarydata, binarysize, &in);
+  replay_input(&in, 1, t);
+}
+
+/* Run "stage" for at least MINTIME and print how fast it went */
+static void run_stage (const char *name, void (*stage) (struct totals *), size_t bytes) {
+  struct totals t;
+  double start = now(), elapsed;
+  int runs = 0;
+  memset(&t, 0, sizeof(t));
+  do {
+    stage(&t);
+    runs++;
+  } while ((elapsed = now() - start) < MINTIME);
+  if (t.plies)
+    printf("  %-22s %12.0f %14.0f %12.1f\n", name, t.games / elapsed, t.plies / elapsed, (double) bytes * runs / elapsed / (1 << 20));
+  else /* Only tokens */
+    printf("  %-22s %12.0f %14s %12.1f   (%.0f tokens/s)\n", name, t.games / elapsed, "-", (double) bytes * runs / elapsed / (1 << 20), t.tokens / elapsed);
+}
+
+/* Keep the first SAMPLES moves of each kind, with the position they are played on */
+static void collect (struct samples *s) {
+  struct pgn2fen_input in;
+  struct pgn2fen_game g;
+  struct pgn2fen_position before;
+  const char *move;
+  size_t start;
+  int len, token, kind;
+
+  memset(s, 0, sizeof(*s));
+  for (kind = 0; kind < KINDS; kind++)
+    s->moves[kind] = malloc(SAMPLES * sizeof(struct sample));
+  s->positions = malloc(KINDS * SAMPLES * sizeof(struct pgn2fen_position));
+  pgn2fen_open_memory(data, size, &in);
+  pgn2fen_init_game(&g);
+  /* The tokens are read here, so we see the SAN of each move */
+  while ((token = pgn2fen_read_token(&in, &move, &len, &start)) != PGN2FEN_TOKEN_EOF) {
+    if (PGN2FEN_TOKEN_MOVE != token) { /* A result or a tag, a new game is coming */
+      if (PGN2FEN_TOKEN_TAG == token)
+        while (in.pos < in.size && data[in.pos] != '\n')
+          in.pos++;
+      pgn2fen_init_game(&g);
+      continue;
+    }
+    before = g.pos;
+    if (pgn2fen_play_san(&g.pos, move, len, &g.move) < 0) { /* Wait for the next game */
+      g.pos = before;
+      continue;
+    }
+    kind = kind_of(move, len);
+    if (s->count[kind] < SAMPLES && len < (int) sizeof(s->moves[kind][0].san)) {
+      s->moves[kind][s->count[kind]].pos = before;
+      memcpy(s->moves[kind][s->count[kind]].san, move, len);
+      s->moves[kind][s->count[kind]].len = len;
+      s->moves[kind][s->count[kind]].move = g.move;
+      s->count[kind]++;
+      s->positions[s->npositions++] = g.pos;
+    }
+  }
+}
+
+/* Play each sample move on a copy of its position until MINTIME is up. Returns nanoseconds per move */
+static double time_moves (const struct sample *moves, int n, int coded) {
+  struct pgn2fen_position pos;
+  double start = now(), elapsed;
+  long played = 0;
+  int i;
+  do {
+    for (i = 0; i < n; i++) {
+      pos = moves[i].pos;
+      if (coded)
+        pgn2fen_play_move(&pos, moves[i].move);
+      else
+        pgn2fen_play(&pos, moves[i].san, moves[i].len);
+      __asm__ volatile ("" : : "g" (&pos) : "memory"); /* Don't let the compiler throw the move away */
+    }
+    played += n;
+  } while ((elapsed = now() - start) < MINTIME);
+  return elapsed * 1e9 / played;
+}
+
+static double time_fens (const struct pgn2fen_position *positions, int n) {
+  char buf[PGN2FEN_FENSIZE];
+  double start = now(), elapsed;
+  long written = 0;
+  int i;
+  do {
+    for (i = 0; i < n; i++) {
+      pgn2fen_fen(&positions[i], buf, sizeof(buf));
+      __asm__ volatile ("" : : "g" (buf) : "memory");
+    }
+    written += n;
+  } while ((elapsed = now() - start) < MINTIME);
+  return elapsed * 1e9 / written;
+}
+
+int main (int argc, char **argv) {
+
+  struct pgn2fen_input in, binary;
+  struct samples s;
+  char binarypath[] = "/tmp/pgn2fen-bench-XXXXXX";
+  int kind, fd, error;
+
+  if (argc != 2) {
+    printf("Usage: %s database.pgn\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  if (pgn2fen_open(argv[1], &in) < 0 || !in.mapped || in.binary) {
+    printf("*** Error: \"%s\" has to be a regular uncompressed PGN file\n", argv[1]);
+    exit(EXIT_FAILURE);
+  }
+  data = in.data;
+  size = in.size;
+
+  /* The binary database, for the last stage */
+  if ((fd = mkstemp(binarypath)) < 0 || (error = pgn2fen_binary_build(argv[1], binarypath)) < 0 ||
+      pgn2fen_open(binarypath, &binary) < 0) {
+    printf("*** Error: The binary database could not be built\n");
+    exit(EXIT_FAILURE);
+  }
+  close(fd);
+  unlink(binarypath);
+  binarydata = binary.data;
+  binarysize = binary.size;
+
+  printf("%s: %.1f MB\n\n", argv[1], size / (double) (1 << 20));
+  printf("  %-22s %12s %14s %12s\n", "stage", "games/s", "plies/s", "MB/s");
+  run_stage("tokenize", tokenize, size);
+  run_stage("replay", replay, size);
+  run_stage("replay + FEN", replay_fen, size);
+  run_stage("binary replay + FEN", replay_binary, binarysize);
+
+  collect(&s);
+  printf("\n  %-22s %12s %14s\n", "move", "SAN ns", "coded ns");
+  for (kind = 0; kind < KINDS; kind++)
+    if (s.count[kind])
+      printf("  %-22s %12.1f %14.1f\n", kindnames[kind], time_moves(s.moves[kind], s.count[kind], 0),
+             time_moves(s.moves[kind], s.count[kind], 1));
+  printf("\n  %-22s %12.1f\n", "FEN ns", time_fens(s.positions, s.npositions));
+
+  pgn2fen_close(&binary);
+  pgn2fen_close(&in);
+  exit(EXIT_SUCCESS);
+}
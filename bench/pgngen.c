@@ -0,0 +1,248 @@
+/*
+ *  pgn2fen - Extracts FEN of a specific move on a PGN game
+ *  -------------------------------------------------------
+ *  Author: mate_amargo - Juan Alberto Regalado Galván
+ *  https://github.com/mate-amargo/pgn2fen
+ *  -------------------------------------------------------
+ *
+ *  Writes made up PGN to stdout for the benchmarks. The games are random but
+ *  legal, picked among the moves pgn2fen_legal_moves gives, and the same seed
+ *  always gives the same games. How much of the text
+ *  is commentaries and variations can be chosen, so the tokenizer can be
+ *  measured on plain and on annotated databases.
+ *
+ *  Usage: pgngen [-m megabytes] [-s seed] [-c comments%] [-v variations%]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../board.h"
+
+#define LINEWIDTH 79     /* Movetext is wrapped like most databases do it */
+#define MAXDEPTH 3       /* Variations inside variations inside variations */
+
+static uint64_t state;
+static char line[LINEWIDTH + 256]; /* Room for a rest of line commentary too */
+static int linelen;
+static size_t written;
+
+static const char *names[] = { "Carlsen, Magnus", "Nakamura, Hikaru", "Caruana, Fabiano", "Firouzja, Alireza",
+                               "Ding, Liren", "Nepomniachtchi, Ian", "Giri, Anish", "So, Wesley", "Aronian, Levon",
+                               "Vachier-Lagrave, Maxime", "Rapport, Richard", "Duda, Jan-Krzysztof" };
+static const char *words[] = { "a", "the", "bishop", "pair", "is", "strong", "weak", "square", "on", "d5",
+                               "initiative", "better", "was", "here", "(long", "term)", "[%eval", "0.35]",
+                               "threatening", "mate", "and", "Black", "White", "should", "play", "Nf3!?" };
+static const char *results[] = { "1-0", "0-1", "1/2-1/2", "*" };
+
+/* splitmix64, the same every time for the same seed */
+static uint64_t next_random (void) {
+  uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+static int chance (int percent) {
+  return (int) (next_random() % 100) < percent;
+}
+
+static void end_line (void) {
+  line[linelen++] = '\n';
+  written += fwrite(line, 1, linelen, stdout);
+  linelen = 0;
+}
+
+/* Add a token to the movetext, starting a new line if it doesn't fit */
+static void emit (const char *token) {
+  int len = strlen(token);
+  if (linelen && linelen + 1 + len > LINEWIDTH)
+    end_line();
+  if (linelen)
+    line[linelen++] = ' ';
+  memcpy(line + linelen, token, len);
+  linelen += len;
+}
+
+static void end_movetext (void) {
+  end_line();
+  written += fwrite("\n", 1, 1, stdout);
+}
+
+/* The kind of piece on "sq", which is occupied */
+static int piece_on (const struct pgn2fen_position *pos, int sq) {
+  int piece;
+  for (piece = PAWN; !(pos->pieces[piece] & BIT(sq)); piece++);
+  return piece;
+}
+
+static int is_castling (const struct pgn2fen_position *pos, pgn2fen_move m) {
+  return KING == piece_on(pos, PGN2FEN_MOVE_FROM(m)) && abs(PGN2FEN_MOVE_TO(m) - PGN2FEN_MOVE_FROM(m)) == 2;
+}
+
+/* Write "m" in SAN to "san". "moves" are the "n" legal moves of the position, the origin is given when */
+/* another one of them takes a piece of the same kind to the same square */
+static void write_san (const struct pgn2fen_position *pos, const pgn2fen_move *moves, int n, pgn2fen_move m, char *san) {
+
+  struct pgn2fen_position after;
+  int from = PGN2FEN_MOVE_FROM(m), to = PGN2FEN_MOVE_TO(m), piece = piece_on(pos, from), i, other;
+  int others = 0, samefile = 0, samerank = 0;
+  char *p = san;
+
+  if (is_castling(pos, m))
+    p += sprintf(p, (to > from)?"O-O":"O-O-O");
+  else {
+    if (PAWN == piece) {
+      if (FILEOF(from) != FILEOF(to))
+        *p++ = 'a' + FILEOF(from);
+    } else {
+      *p++ = " NBRQK"[piece];
+      for (i = 0; i < n; i++) {
+        other = PGN2FEN_MOVE_FROM(moves[i]);
+        if (PGN2FEN_MOVE_TO(moves[i]) == to && other != from && piece_on(pos, other) == piece) {
+          others = 1;
+          samefile |= FILEOF(other) == FILEOF(from);
+          samerank |= RANKOF(other) == RANKOF(from);
+        }
+      }
+      if (others && (!samefile || samerank)) /* The file if it tells them apart, the rank if it doesn't */
+        *p++ = 'a' + FILEOF(from);
+      if (samefile)
+        *p++ = '1' + RANKOF(from);
+    }
+    if ((pos->occupied & BIT(to)) || (PAWN == piece && FILEOF(from) != FILEOF(to)))
+      *p++ = 'x';
+    *p++ = 'a' + FILEOF(to);
+    *p++ = '1' + RANKOF(to);
+    if (PGN2FEN_MOVE_PROMOTION(m)) {
+      *p++ = '=';
+      *p++ = " NBRQ"[PGN2FEN_MOVE_PROMOTION(m)];
+    }
+  }
+  after = *pos;
+  pgn2fen_play_move(&after, m);
+  if (pgn2fen_in_check(&after))
+    *p++ = '+';
+  *p = '\0';
+}
+
+/* Pick a move. Pawn moves, castling and promotions are favoured a bit, or random games would hardly have any */
+static pgn2fen_move pick (const struct pgn2fen_position *pos, const pgn2fen_move *moves, int n) {
+  int i, start = next_random() % n;
+  if (chance(60))
+    for (i = 0; i < n; i++)
+      if (PGN2FEN_MOVE_PROMOTION(moves[(start + i) % n]) || is_castling(pos, moves[(start + i) % n]))
+        return moves[(start + i) % n];
+  if (chance(35))
+    for (i = 0; i < n; i++)
+      if (PAWN == piece_on(pos, PGN2FEN_MOVE_FROM(moves[(start + i) % n])))
+        return moves[(start + i) % n];
+  return moves[start];
+}
+
+/* Write the move number if it's needed: always before White's moves, before Black's after a break */
+static void emit_number (const struct pgn2fen_position *pos, int *needed) {
+  char number[16];
+  if (pos->turn || *needed) {
+    sprintf(number, (pos->turn)?"%d.":"%d...", pos->fullmove);
+    emit(number);
+  }
+  *needed = 0;
+}
+
+static void emit_comment (void) {
+  char comment[256];
+  int i, len, n = 1 + next_random() % 12;
+  if (chance(10)) { /* A rest of line commentary, it can't be wrapped */
+    for (i = 0, len = 1, comment[0] = ';'; i < n; i++)
+      len += sprintf(comment + len, " %s", words[next_random() % (sizeof(words) / sizeof(*words))]);
+    if (linelen && linelen + 1 + len > LINEWIDTH)
+      end_line();
+    emit(comment);
+    end_line();
+    return;
+  }
+  emit("{");
+  for (i = 0; i < n; i++)
+    emit(words[next_random() % (sizeof(words) / sizeof(*words))]);
+  emit("}");
+}
+
+/* Play and write up to "plies" moves from "pos". Variations of other moves are written along the way */
+static int play_line (struct pgn2fen_position *pos, int plies, int depth, int comments, int variations) {
+
+  pgn2fen_move moves[PGN2FEN_MAXMOVES], m;
+  struct pgn2fen_position before;
+  char san[16];
+  int n, played, needed = 1;
+
+  for (played = 0; played < plies && (n = pgn2fen_legal_moves(pos, moves)) > 0; played++) {
+    m = pick(pos, moves, n);
+    before = *pos;
+    emit_number(pos, &needed);
+    write_san(pos, moves, n, m, san);
+    if (chance(3))
+      strcat(san, (chance(50))?"!":"?!");
+    emit(san);
+    pgn2fen_play_move(pos, m);
+    if (chance(2))
+      emit("$1");
+    if (chance(comments)) {
+      emit_comment();
+      needed = 1;
+    }
+    if (depth < MAXDEPTH && chance(variations)) { /* Something else instead of the move just played */
+      emit("(");
+      play_line(&before, 1 + next_random() % 6, depth + 1, comments, variations);
+      emit(")");
+      needed = 1;
+    }
+  }
+  return played;
+}
+
+static void write_game (int number, int comments, int variations) {
+
+  struct pgn2fen_position pos;
+  char tag[128];
+  const char *result = results[next_random() % 4];
+
+  sprintf(tag, "[Event \"Generated %d\"]\n[Site \"pgngen\"]\n[Date \"%d.%02d.%02d\"]\n[Round \"%d\"]\n",
+          number, 1990 + (int) (next_random() % 35), 1 + (int) (next_random() % 12), 1 + (int) (next_random() % 28), number);
+  written += fwrite(tag, 1, strlen(tag), stdout);
+  sprintf(tag, "[White \"%s\"]\n[Black \"%s\"]\n[Result \"%s\"]\n\n", names[next_random() % 12], names[next_random() % 12], result);
+  written += fwrite(tag, 1, strlen(tag), stdout);
+
+  pgn2fen_init_position(&pos);
+  play_line(&pos, 20 + next_random() % 140, 0, comments, variations);
+  emit(result);
+  end_movetext();
+}
+
+int main (int argc, char **argv) {
+
+  double megabytes = 16;
+  int comments = 10, variations = 5, i, games;
+
+  state = 0x70676e3267656e; /* Default seed */
+  for (i = 1; i < argc; i++)
+    if (!strcmp(argv[i], "-m") && i+1 < argc)
+      megabytes = atof(argv[++i]);
+    else if (!strcmp(argv[i], "-s") && i+1 < argc)
+      state = strtoull(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "-c") && i+1 < argc)
+      comments = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-v") && i+1 < argc)
+      variations = atoi(argv[++i]);
+    else {
+      printf("Usage: %s [-m megabytes] [-s seed] [-c comments%%] [-v variations%%]\n", argv[0]);
+      printf("  Writes random but legal games to stdout until there are that many megabytes (16 by default).\n");
+      printf("  -c and -v are the chance of a commentary and of a variation after each move (10 and 5 by default).\n");
+      exit(EXIT_FAILURE);
+    }
+
+  for (games = 1; written < megabytes * (1 << 20); games++)
+    write_game(games, comments, variations);
+  exit(EXIT_SUCCESS);
+}
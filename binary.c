@@ -0,0 +1,165 @@
+/*
+ *  pgn2fen - Extracts FEN of a specific move on a PGN game
+ *  -------------------------------------------------------
+ *  Author: mate_amargo - Juan Alberto Regalado Galván
+ *  https://github.com/mate-amargo/pgn2fen
+ *  -------------------------------------------------------
+ *
+ *  Binary databases: the games of a PGN replayed once and written down as
+ *  coded moves, so they can be replayed again and again without reading SAN.
+ *
+ *  The file is a header followed by the games, in the byte order of the
+ *  machine that built it. Each game is its offset in the PGN, how many moves
+ *  it has, some flags, and the moves, 16 bits each:
+ *
+ *    "PGN2FENB" count  offset plies flags move move ...  offset plies flags ...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "board.h"
+
+#define BINARYGAME 12         /* Offset (8 bytes), plies (2) and flags (2) */
+#define BINARYMAXPLY 0xFFFF   /* Longer games are cut there */
+#define BINARYSTOPPED 1       /* The game goes on in the PGN, with a move that can't be played */
+
+struct binaryheader {
+  char magic[8];
+  uint64_t count;
+};
+
+/* Replay every game of "pgnpath" and write them to "binarypath". Games with a move that can't be played are */
+/* kept up to that move, and replaying them gives the same error there */
+int pgn2fen_binary_build (const char *pgnpath, const char *binarypath) {
+
+  struct pgn2fen_input in;
+  struct pgn2fen_game g;
+  struct binaryheader header;
+  unsigned char game[BINARYGAME];
+  pgn2fen_move *moves = NULL, *tmp;
+  uint64_t offset;
+  uint16_t plies, flags;
+  size_t n, size = 0;
+  FILE *out;
+  int error, moved;
+
+  if ((error = pgn2fen_open(pgnpath, &in)) < 0)
+    return error;
+  if ((out = fopen(binarypath, "wb")) == NULL) {
+    pgn2fen_close(&in);
+    return PGN2FEN_EWRITE;
+  }
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, BINARYMAGIC, sizeof(header.magic));
+
+  /* The count goes in the header, we know it at the end */
+  if (fwrite(&header, sizeof(header), 1, out) != 1)
+    error = PGN2FEN_EWRITE;
+  while (!error) {
+    pgn2fen_init_game(&g);
+    for (n = 0; (moved = pgn2fen_next_move(&in, &g, 1)) > 0; ) {
+      if (n == BINARYMAXPLY)
+        continue;
+      if (n == size) {
+        size = (size)?2*size:256;
+        if ((tmp = realloc(moves, size * sizeof(*moves))) == NULL) {
+          error = PGN2FEN_ENOMEM;
+          break;
+        }
+        moves = tmp;
+      }
+      moves[n++] = g.move;
+    }
+    if (error || !g.started)
+      break;
+    if (moved < 0 && PGN2FEN_ESAN != moved && PGN2FEN_EILLEGAL != moved) { /* The input, not the game */
+      error = moved;
+      break;
+    }
+    offset = g.offset;
+    plies = n;
+    flags = (moved < 0)?BINARYSTOPPED:0;
+    memcpy(game, &offset, 8);
+    memcpy(game + 8, &plies, 2);
+    memcpy(game + 10, &flags, 2);
+    if (fwrite(game, sizeof(game), 1, out) != 1 || fwrite(moves, sizeof(*moves), n, out) != n)
+      error = PGN2FEN_EWRITE;
+    header.count++;
+    if (moved != 0) /* Read past the rest of it */
+      pgn2fen_skip_game(&in, &g);
+  }
+  if (!error)
+    error = in.error;
+  if (!error && (fseek(out, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, out) != 1))
+    error = PGN2FEN_EWRITE;
+  if (fclose(out) != 0 && !error)
+    error = PGN2FEN_EWRITE;
+  if (error)
+    unlink(binarypath);
+  free(moves);
+  pgn2fen_close(&in);
+  return error;
+}
+
+/* Have at least "n" bytes of the input at hand. Returns 0 if there aren't that many left */
+static int have (struct pgn2fen_input *in, size_t n) {
+  while (in->size - in->pos < n)
+    if (!pgn2fen_refill(in))
+      return 0;
+  return 1;
+}
+
+/* pgn2fen_next_move for binary databases. The moves are played as they come, there's no SAN to work out */
+int pgn2fen_next_binary_move (struct pgn2fen_input *in, struct pgn2fen_game *g, int play) {
+
+  uint64_t offset;
+  uint16_t plies, flags;
+  pgn2fen_move move;
+  int error;
+
+  if (!g->started && !g->over) {
+    if (!have(in, BINARYGAME)) {
+      g->over = 1;
+      if (in->pos < in->size && !in->error) /* Part of a game */
+        in->error = PGN2FEN_EFORMAT;
+      return in->error;
+    }
+    memcpy(&offset, in->data + in->pos, 8);
+    memcpy(&plies, in->data + in->pos + 8, 2);
+    memcpy(&flags, in->data + in->pos + 10, 2);
+    in->pos += BINARYGAME;
+    g->started = 1;
+    g->offset = offset;
+    g->left = plies;
+    g->stopped = flags & BINARYSTOPPED;
+  }
+  if (g->over)
+    return in->error;
+  if (!g->left) { /* As in the PGN, it ends with its result or with a move that can't be played */
+    g->over = 1;
+    g->next = in->base + in->pos;
+    return (g->stopped)?PGN2FEN_EILLEGAL:in->error;
+  }
+  if (!have(in, sizeof(move))) {
+    g->over = 1;
+    if (!in->error)
+      in->error = PGN2FEN_EFORMAT;
+    return in->error;
+  }
+  memcpy(&move, in->data + in->pos, sizeof(move));
+  in->pos += sizeof(move);
+  g->left--;
+  g->movetext = 1;
+  g->next = in->base + in->pos;
+  if (!play)
+    return 1;
+  if ((error = pgn2fen_play_move(&g->pos, move)) < 0)
+    return error;
+  g->move = move;
+  g->ply++;
+  STAT(plies, 1);
+  return 1;
+}
@@ -0,0 +1,98 @@
+/*
+ *  pgn2fen - Extracts FEN of a specific move on a PGN game
+ *  -------------------------------------------------------
+ *  Author: mate_amargo - Juan Alberto Regalado Galván
+ *  https://github.com/mate-amargo/pgn2fen
+ *  -------------------------------------------------------
+ *
+ *  Shorthands used inside the library and the program. Not for the outside
+ *  world, which only gets pgn2fen.h
+ */
+
+#ifndef BOARD_H
+#define BOARD_H
+
+#include "pgn2fen.h"
+
+#define FILES 8            /* Board files (columns) (a-h) */
+#define RANKS 8            /* Board ranks (rows) (1-8) */
+#define CASTLEK (1 << 3)  /* White can castle Kingside */
+#define CASTLEQ (1 << 2)  /* White can castle Queenside */
+#define CASTLEk (1 << 1)  /* Black can castle Kingside */
+#define CASTLEq 1         /* Black can castle Queenside */
+#define WHITE 1            /* Used to determine which turn... */
+#define BLACK 0            /* ...is whilst traversing the list of moves */
+#define PAWN 0             /* Piece types, they index the bitboards of the position */
+#define KNIGHT 1
+#define BISHOP 2
+#define ROOK 3
+#define QUEEN 4
+#define KING 5
+#define NPIECES 6
+#define NOSQUARE -1
+#define SQUARE(f, r) ((r) * FILES + (f)) /* Squares are numbered a1 = 0, b1 = 1, ... h8 = 63 */
+#define FILEOF(sq) ((sq) % FILES)
+#define RANKOF(sq) ((sq) / FILES)
+#define BIT(sq) ((bitboard) 1 << (sq))
+#define LSB(b) __builtin_ctzll(b) /* Lowest square of a non empty set */
+#define FILEA 0x0101010101010101ULL
+#define FILEB (FILEA << 1)
+#define FILEG (FILEA << 6)
+#define FILEH (FILEA << 7)
+#define RANK1 0xFFULL
+#define RANK2 (RANK1 << 8)
+#define RANK7 (RANK1 << 48)
+#define RANK8 (RANK1 << 56)
+
+typedef pgn2fen_bitboard bitboard;
+
+/* Statistics, in stats.c. They are nothing at all unless we are built with PGN2FEN_STATS */
+#ifdef PGN2FEN_STATS
+extern __thread struct pgn2fen_stats pgn2fen_counters;
+void pgn2fen_stats_clock (double *wall, double *cpu);
+#define STAT(counter, n) (pgn2fen_counters.counter += (n))
+#define STAT_TIMER double statwall, statcpu
+#define STAT_START() pgn2fen_stats_clock(&statwall, &statcpu)
+#define STAT_STOP(wall, cpu) do { \
+    double w, c; \
+    pgn2fen_stats_clock(&w, &c); \
+    pgn2fen_counters.wall += w - statwall; \
+    pgn2fen_counters.cpu += c - statcpu; \
+  } while (0)
+#else
+#define STAT(counter, n) ((void) 0)
+#define STAT_TIMER int statunused __attribute__((unused))
+#define STAT_START() ((void) 0)
+#define STAT_STOP(wall, cpu) ((void) 0)
+#endif
+
+/* The enpassant square if it can be used, and whether the side to move is in check, in position.c */
+int pgn2fen_enpassant (const struct pgn2fen_position *pos);
+int pgn2fen_in_check (const struct pgn2fen_position *pos);
+
+/* Scanning, in scan.c */
+void pgn2fen_init_scan (void);
+const char *pgn2fen_scan (const char *p, const char *end, const char *set, int n);
+const char *pgn2fen_skip_variation (const char *p, const char *end);
+
+/* Reading PGN a line at a time without looking at the moves, in pgn.c */
+#define PGN2FEN_LINE_MOVETEXT 0
+#define PGN2FEN_LINE_TAG 1
+#define PGN2FEN_LINE_EMPTY 2 /* Blank, or escaped with "%" */
+int pgn2fen_skim_line (const char **line, const char *end, int *comment, int linestart);
+
+/* Tags, in tags.c */
+void pgn2fen_read_tag (const char *line, const char *end, struct pgn2fen_tags *tags);
+
+/* Binary databases, in binary.c */
+#define BINARYMAGIC "PGN2FENB"
+#define BINARYHEADER 16     /* The magic and the number of games */
+int pgn2fen_next_binary_move (struct pgn2fen_input *in, struct pgn2fen_game *g, int play);
+
+/* Compressed input, in decompress.c */
+int pgn2fen_compressed (const unsigned char *magic, size_t n);
+int pgn2fen_start_decoder (struct pgn2fen_input *in, int format, const unsigned char *prefix, size_t nprefix, const void *src, size_t srcsize);
+int pgn2fen_decoded (struct pgn2fen_input *in);
+void pgn2fen_stop_decoder (struct pgn2fen_input *in);
+
+#endif
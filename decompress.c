@@ -0,0 +1,304 @@
+/*
+ *  pgn2fen - Extracts FEN of a specific move on a PGN game
+ *  -------------------------------------------------------
+ *  Author: mate_amargo - Juan Alberto Regalado Galván
+ *  https://github.com/mate-amargo/pgn2fen
+ *  -------------------------------------------------------
+ *
+ *  Compressed input. Files compressed with gzip (or zstd, if we were built with
+ *  ZSTD=1) are told apart by their first bytes and decompressed on a thread of
+ *  their own, which fills a ring of buffers ahead of the tokenizer. That way
+ *  decompressing and parsing happen at the same time.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <zlib.h>
+#ifdef PGN2FEN_ZSTD
+#include <zstd.h>
+#endif
+
+#include "board.h"
+
+#define RINGBUFFERS 4            /* How far ahead of the tokenizer the decoder may get... */
+#define RINGBUFFERSIZE (1 << 18) /* ...in pieces this big */
+#define READSIZE (1 << 17)       /* Compressed bytes read at a time */
+#define GZIP 1
+#define ZSTD 2
+
+struct ringbuffer {
+  char *data;
+  size_t len;
+};
+
+struct decoder {
+  int format; /* GZIP or ZSTD */
+  int fd;
+  const unsigned char *src; /* The compressed file when it's mapped... */
+  size_t srcsize;
+  unsigned char *inbuf; /* ...or what we read of it when it isn't */
+  unsigned char prefix[4]; /* Bytes read to find out the format, they come before everything else */
+  size_t nprefix;
+  int inputdone;
+  int midstream; /* We are halfway through a gzip member or zstd frame. If the input ends there, it's truncated */
+  z_stream z;
+#ifdef PGN2FEN_ZSTD
+  ZSTD_DStream *zstd;
+  ZSTD_inBuffer zin;
+#endif
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  struct ringbuffer ring[RINGBUFFERS];
+  unsigned long filled, taken; /* Buffers filled by the decoder and taken by the tokenizer so far */
+  int done; /* The decoder is finished, whatever is in the ring is all there is */
+  int error;
+  int stop; /* The input is being closed */
+};
+
+/* The format of a file that begins with "magic", 0 if it isn't compressed (or we can't tell yet) */
+int pgn2fen_compressed (const unsigned char *magic, size_t n) {
+  if (n >= 2 && 0x1F == magic[0] && 0x8B == magic[1])
+    return GZIP;
+  if (n >= 4 && 0x28 == magic[0] && 0xB5 == magic[1] && 0x2F == magic[2] && 0xFD == magic[3])
+    return ZSTD;
+  return 0;
+}
+
+/* The next compressed bytes. Returns 0 when there are no more */
+static size_t next_input (struct decoder *d, const unsigned char **p) {
+  ssize_t n;
+  if (d->inputdone)
+    return 0;
+  if (d->nprefix) {
+    *p = d->prefix;
+    n = d->nprefix;
+    d->nprefix = 0;
+    return n;
+  }
+  if (d->src) { /* All of it in one go */
+    *p = d->src;
+    d->inputdone = 1;
+    return d->srcsize;
+  }
+  if ((n = read(d->fd, d->inbuf, READSIZE)) <= 0) {
+    if (n < 0)
+      d->error = PGN2FEN_EREAD;
+    d->inputdone = 1;
+    return 0;
+  }
+  *p = d->inbuf;
+  return n;
+}
+
+/* Decompress up to "size" bytes to "out". Returns how many, 0 at the end, or an error. What was */
+/* decompressed before an error is handed over first, the error comes in the next call */
+static long inflate_some (struct decoder *d, char *out, size_t size) {
+  const unsigned char *p = NULL;
+  int ret;
+  d->z.next_out = (unsigned char *) out;
+  d->z.avail_out = size;
+  while (d->z.avail_out && !d->error) {
+    if (!d->z.avail_in) {
+      d->z.avail_in = next_input(d, &p);
+      d->z.next_in = (unsigned char *) p;
+      if (!d->z.avail_in) {
+        if (d->midstream && !d->error)
+          d->error = PGN2FEN_EDECOMPRESS;
+        break;
+      }
+    }
+    ret = inflate(&d->z, Z_NO_FLUSH);
+    d->midstream = 1;
+    if (Z_STREAM_END == ret) { /* Files may be several gzip members one after the other */
+      d->midstream = 0;
+      if (inflateReset(&d->z) != Z_OK)
+        d->error = PGN2FEN_EDECOMPRESS;
+    } else if (ret != Z_OK)
+      d->error = PGN2FEN_EDECOMPRESS;
+  }
+  if (size - d->z.avail_out)
+    return size - d->z.avail_out;
+  return d->error;
+}
+
+#ifdef PGN2FEN_ZSTD
+static long unzstd_some (struct decoder *d, char *out, size_t size) {
+  ZSTD_outBuffer zout = { out, size, 0 };
+  const unsigned char *p = NULL;
+  size_t ret;
+  while (zout.pos < zout.size && !d->error) {
+    if (d->zin.pos == d->zin.size) {
+      d->zin.size = next_input(d, &p);
+      d->zin.src = p;
+      d->zin.pos = 0;
+      if (!d->zin.size) {
+        if (d->midstream && !d->error)
+          d->error = PGN2FEN_EDECOMPRESS;
+        break;
+      }
+    }
+    ret = ZSTD_decompressStream(d->zstd, &zout, &d->zin);
+    if (ZSTD_isError(ret))
+      d->error = PGN2FEN_EDECOMPRESS;
+    d->midstream = (ret != 0); /* 0 means a frame just ended */
+  }
+  if (zout.pos)
+    return zout.pos;
+  return d->error;
+}
+#endif
+
+static void *decode (void *arg) {
+  struct decoder *d = arg;
+  struct ringbuffer *b;
+  long n;
+  int stop;
+
+  for (;;) {
+    pthread_mutex_lock(&d->lock);
+    while (d->filled - d->taken == RINGBUFFERS && !d->stop) /* The ring is full, wait for the tokenizer */
+      pthread_cond_wait(&d->cond, &d->lock);
+    stop = d->stop;
+    pthread_mutex_unlock(&d->lock);
+    if (stop)
+      break;
+    b = &d->ring[d->filled % RINGBUFFERS]; /* Nobody else touches it until we say it's filled */
+#ifdef PGN2FEN_ZSTD
+    if (ZSTD == d->format)
+      n = unzstd_some(d, b->data, RINGBUFFERSIZE);
+    else
+#endif
+      n = inflate_some(d, b->data, RINGBUFFERSIZE);
+    pthread_mutex_lock(&d->lock);
+    if (n > 0) {
+      b->len = n;
+      d->filled++;
+    } else {
+      d->error = (n < 0)?n:0;
+      d->done = 1;
+    }
+    pthread_cond_broadcast(&d->cond);
+    pthread_mutex_unlock(&d->lock);
+    if (n <= 0)
+      break;
+  }
+  return NULL;
+}
+
+/* Start decompressing "in", whose first "nprefix" bytes are already read into "prefix". If the file is */
+/* mapped, "src" is all of it instead, and it's ours to unmap from now on unless we fail */
+int pgn2fen_start_decoder (struct pgn2fen_input *in, int format, const unsigned char *prefix, size_t nprefix, const void *src, size_t srcsize) {
+
+  struct decoder *d;
+  int i;
+
+#ifndef PGN2FEN_ZSTD
+  if (ZSTD == format) /* We weren't built with it */
+    return PGN2FEN_EDECOMPRESS;
+#endif
+  if ((d = calloc(1, sizeof(*d))) == NULL)
+    return PGN2FEN_ENOMEM;
+  d->format = format;
+  d->fd = in->fd;
+  d->src = src;
+  d->srcsize = srcsize;
+  if (!src) {
+    memcpy(d->prefix, prefix, nprefix);
+    d->nprefix = nprefix;
+  }
+  if ((!src && (d->inbuf = malloc(READSIZE)) == NULL) || (GZIP == format && inflateInit2(&d->z, 15 + 32) != Z_OK)) {
+    free(d->inbuf);
+    free(d);
+    return PGN2FEN_ENOMEM;
+  }
+#ifdef PGN2FEN_ZSTD
+  if (ZSTD == format && (d->zstd = ZSTD_createDStream()) == NULL) {
+    free(d->inbuf);
+    free(d);
+    return PGN2FEN_ENOMEM;
+  }
+#endif
+  for (i = 0; i < RINGBUFFERS; i++)
+    if ((d->ring[i].data = malloc(RINGBUFFERSIZE)) == NULL)
+      break;
+  pthread_mutex_init(&d->lock, NULL);
+  pthread_cond_init(&d->cond, NULL);
+  in->decoder = d;
+  if (i < RINGBUFFERS || pthread_create(&d->thread, NULL, decode, d) != 0) {
+    d->thread = pthread_self(); /* There's no thread to join... */
+    d->src = NULL;              /* ...and the mapping is still the caller's */
+    pgn2fen_stop_decoder(in);
+    return PGN2FEN_ENOMEM;
+  }
+  return 0;
+}
+
+/* The next piece of decompressed input, appended to the window of "in". Returns 0 if there's no more */
+int pgn2fen_decoded (struct pgn2fen_input *in) {
+
+  struct decoder *d = in->decoder;
+  struct ringbuffer *b;
+  char *tmp;
+  size_t cap;
+
+  pthread_mutex_lock(&d->lock);
+  while (d->filled == d->taken && !d->done)
+    pthread_cond_wait(&d->cond, &d->lock);
+  if (d->filled == d->taken) { /* It's over */
+    in->error = d->error;
+    pthread_mutex_unlock(&d->lock);
+    return 0;
+  }
+  pthread_mutex_unlock(&d->lock);
+
+  b = &d->ring[d->taken % RINGBUFFERS];
+  for (cap = in->cap; cap - in->size < b->len; cap *= 2);
+  if (cap != in->cap) {
+    if ((tmp = realloc(in->buf, cap)) == NULL) {
+      in->error = PGN2FEN_ENOMEM;
+      return 0;
+    }
+    in->data = in->buf = tmp;
+    in->cap = cap;
+  }
+  memcpy(in->buf + in->size, b->data, b->len);
+  in->size += b->len;
+  STAT(bytes, b->len);
+
+  pthread_mutex_lock(&d->lock);
+  d->taken++;
+  pthread_cond_broadcast(&d->cond);
+  pthread_mutex_unlock(&d->lock);
+  return 1;
+}
+
+/* Stop the decoder and let go of everything it had */
+void pgn2fen_stop_decoder (struct pgn2fen_input *in) {
+  struct decoder *d = in->decoder;
+  int i;
+  pthread_mutex_lock(&d->lock);
+  d->stop = 1;
+  pthread_cond_broadcast(&d->cond);
+  pthread_mutex_unlock(&d->lock);
+  if (!pthread_equal(d->thread, pthread_self()))
+    pthread_join(d->thread, NULL);
+  if (GZIP == d->format)
+    inflateEnd(&d->z);
+#ifdef PGN2FEN_ZSTD
+  if (ZSTD == d->format)
+    ZSTD_freeDStream(d->zstd);
+#endif
+  if (d->src)
+    munmap((void *) d->src, d->srcsize);
+  for (i = 0; i < RINGBUFFERS; i++)
+    free(d->ring[i].data);
+  free(d->inbuf);
+  pthread_cond_destroy(&d->cond);
+  pthread_mutex_destroy(&d->lock);
+  free(d);
+  in->decoder = NULL;
+}
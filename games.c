@@ -0,0 +1,185 @@
+/*
+ *  pgn2fen - Extracts FEN of a specific move on a PGN game
+ *  -------------------------------------------------------
+ *  Author: mate_amargo - Juan Alberto Regalado Galván
+ *  https://github.com/mate-amargo/pgn2fen
+ *  -------------------------------------------------------
+ *
+ *  The game index: where each game of a PGN begins and how long it is, with a
+ *  few of its tags, so game N can be found without reading the N-1 before it.
+ *
+ *  The file is a header followed by one fixed size entry per game, in the
+ *  byte order of the machine that built it:
+ *
+ *    "PGN2FENG" count pgnsize pgnmtime entry entry ...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "board.h"
+
+#define GAMESMAGIC "PGN2FENG"
+
+struct gamesheader {
+  char magic[8];
+  uint64_t count;
+  uint64_t pgnsize; /* The PGN we were built from, to notice if it changes */
+  int64_t pgnmtime;
+};
+
+/* Copy a tag value to a field of the entry "size" bytes long, cut if it doesn't fit */
+static void copy_tag (char *field, const char *value, size_t size) {
+  size_t n = strlen(value);
+  n = (n < size)?n:size - 1;
+  memcpy(field, value, n);
+  field[n] = '\0';
+}
+
+/* Write the entry of a game, with the tags we keep in the index */
+static int write_entry (FILE *out, struct pgn2fen_gameentry *e, const struct pgn2fen_tags *tags) {
+  copy_tag(e->white, tags->white, sizeof(e->white));
+  copy_tag(e->black, tags->black, sizeof(e->black));
+  copy_tag(e->date, tags->date, sizeof(e->date));
+  copy_tag(e->result, tags->result, sizeof(e->result));
+  return (fwrite(e, sizeof(*e), 1, out) != 1)?PGN2FEN_EWRITE:0;
+}
+
+/* Find where each game begins, a line at a time. A game begins with a tag line that comes after movetext. */
+/* This is much quicker than reading the moves, and gives the same games as long as each one has tags */
+static int find_games (const char *data, size_t size, FILE *out, uint64_t *count) {
+
+  const char *p = data, *end = data + size, *next, *q;
+  struct pgn2fen_gameentry e;
+  struct pgn2fen_tags tags;
+  int movetext = 0, started = 0, comment = 0, error;
+
+  memset(&e, 0, sizeof(e));
+  memset(&tags, 0, sizeof(tags));
+  for (; p < end; p = next) {
+    next = ((q = memchr(p, '\n', end - p)) != NULL)?q + 1:end;
+    q = p;
+    switch (pgn2fen_skim_line(&q, next, &comment, 1)) {
+      case PGN2FEN_LINE_EMPTY:
+        continue;
+      case PGN2FEN_LINE_TAG:
+        if (movetext || !started) { /* The tags of a new game, the last one is complete */
+          if (started) {
+            e.length = (q - data) - e.offset;
+            if ((error = write_entry(out, &e, &tags)) < 0)
+              return error;
+            (*count)++;
+            memset(&e, 0, sizeof(e));
+            memset(&tags, 0, sizeof(tags));
+          }
+          e.offset = q - data;
+          started = 1;
+          movetext = 0;
+        }
+        pgn2fen_read_tag(q, next, &tags);
+        continue;
+    }
+    if (!started) { /* Moves without tags at the beginning of the file */
+      e.offset = q - data;
+      started = 1;
+    }
+    movetext = 1;
+  }
+  if (started) {
+    e.length = size - e.offset;
+    if ((error = write_entry(out, &e, &tags)) < 0)
+      return error;
+    (*count)++;
+  }
+  return 0;
+}
+
+/* Find every game of "pgnpath" and write the game index to "indexpath". The PGN has to be a regular file */
+int pgn2fen_games_build (const char *pgnpath, const char *indexpath) {
+
+  struct pgn2fen_input in;
+  struct gamesheader header;
+  struct stat st;
+  FILE *out;
+  int error;
+
+  if ((error = pgn2fen_open(pgnpath, &in)) < 0)
+    return error;
+  if (!in.mapped || fstat(in.fd, &st) < 0) {
+    pgn2fen_close(&in);
+    return PGN2FEN_EOPEN;
+  }
+  if (in.binary) { /* Offsets in it are offsets in the PGN it came from */
+    pgn2fen_close(&in);
+    return PGN2FEN_EFORMAT;
+  }
+  if ((out = fopen(indexpath, "wb")) == NULL) {
+    pgn2fen_close(&in);
+    return PGN2FEN_EWRITE;
+  }
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, GAMESMAGIC, sizeof(header.magic));
+  header.pgnsize = st.st_size;
+  header.pgnmtime = st.st_mtime;
+
+  /* The count goes in the header, we know it at the end */
+  if (fwrite(&header, sizeof(header), 1, out) != 1)
+    error = PGN2FEN_EWRITE;
+  if (!error)
+    error = find_games(in.data, in.size, out, &header.count);
+  if (!error && (fseek(out, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, out) != 1))
+    error = PGN2FEN_EWRITE;
+  if (fclose(out) != 0 && !error)
+    error = PGN2FEN_EWRITE;
+  if (error)
+    unlink(indexpath);
+  pgn2fen_close(&in);
+  return error;
+}
+
+/* Map the game index "indexpath" of "pgnpath". Returns PGN2FEN_ESTALE if the PGN changed since it was built */
+int pgn2fen_games_open (const char *indexpath, const char *pgnpath, struct pgn2fen_games *idx) {
+
+  const struct gamesheader *header;
+  struct stat st, pgnst;
+  void *map;
+  int fd;
+
+  memset(idx, 0, sizeof(*idx));
+  if (stat(pgnpath, &pgnst) < 0 || (fd = open(indexpath, O_RDONLY)) < 0)
+    return PGN2FEN_EOPEN;
+  if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(struct gamesheader)) {
+    close(fd);
+    return PGN2FEN_EFORMAT;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (MAP_FAILED == map)
+    return PGN2FEN_EREAD;
+  header = map;
+  if (memcmp(header->magic, GAMESMAGIC, sizeof(header->magic)) ||
+      st.st_size != (off_t) (sizeof(*header) + header->count * sizeof(struct pgn2fen_gameentry))) {
+    munmap(map, st.st_size);
+    return PGN2FEN_EFORMAT;
+  }
+  if (header->pgnsize != (uint64_t) pgnst.st_size || header->pgnmtime != (int64_t) pgnst.st_mtime) {
+    munmap(map, st.st_size);
+    return PGN2FEN_ESTALE;
+  }
+  idx->map = map;
+  idx->mapsize = st.st_size;
+  idx->games = (const struct pgn2fen_gameentry *) (header + 1);
+  idx->count = header->count;
+  return 0;
+}
+
+void pgn2fen_games_close (struct pgn2fen_games *idx) {
+  if (idx->map)
+    munmap(idx->map, idx->mapsize);
+  memset(idx, 0, sizeof(*idx));
+}
@@ -0,0 +1,229 @@
+/*
+ *  pgn2fen - Extracts FEN of a specific move on a PGN game
+ *  -------------------------------------------------------
+ *  Author: mate_amargo - Juan Alberto Regalado Galván
+ *  https://github.com/mate-amargo/pgn2fen
+ *  -------------------------------------------------------
+ *
+ *  The position index: every position of every game of a PGN, sorted by its
+ *  Zobrist key, so the games reaching a position are found with a binary search.
+ *
+ *  The file is a header followed by the entries, in the byte order of the
+ *  machine that built it:
+ *
+ *    "PGN2FNI2" count pgnsize pgnmtime entry entry ...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "board.h"
+
+#define INDEXMAGIC "PGN2FNI2" /* Since keys leave out en passant squares no pawn can use, older indexes have other keys */
+#define INDEXRUN (1 << 22)  /* Entries sorted in memory at a time, 64 MB. Bigger databases are sorted in runs and merged */
+#define INDEXMAXPLY 0xFFFF  /* The ply has to fit in the low 16 bits */
+
+struct indexheader {
+  char magic[8];
+  uint64_t count;
+  uint64_t pgnsize; /* The PGN we were built from, to notice if it changes */
+  int64_t pgnmtime;
+};
+
+/* A sorted run of entries, spilled to a temporary file */
+struct indexrun {
+  FILE *f;
+  struct pgn2fen_indexentry next; /* The lowest entry we haven't merged yet */
+  int done;
+};
+
+static int compare_entries (const void *a, const void *b) {
+  const struct pgn2fen_indexentry *x = a, *y = b;
+  if (x->key != y->key)
+    return (x->key < y->key)?-1:1;
+  return (x->where < y->where)?-1:(x->where > y->where);
+}
+
+/* Sort the entries we have and put them aside in a temporary file */
+static int spill_run (struct pgn2fen_indexentry *entries, size_t n, struct indexrun **runs, int *nruns) {
+  struct indexrun *tmp;
+  FILE *f;
+  qsort(entries, n, sizeof(*entries), compare_entries);
+  if ((f = tmpfile()) == NULL)
+    return PGN2FEN_EWRITE;
+  if (fwrite(entries, sizeof(*entries), n, f) != n) {
+    fclose(f);
+    return PGN2FEN_EWRITE;
+  }
+  rewind(f);
+  if ((tmp = realloc(*runs, (*nruns + 1) * sizeof(struct indexrun))) == NULL) {
+    fclose(f);
+    return PGN2FEN_ENOMEM;
+  }
+  *runs = tmp;
+  (*runs)[*nruns].f = f;
+  (*runs)[*nruns].done = (fread(&(*runs)[*nruns].next, sizeof(struct pgn2fen_indexentry), 1, f) != 1);
+  (*nruns)++;
+  return 0;
+}
+
+/* Write the runs out as one, in order. There are few of them, so a linear search for the lowest is enough */
+static int merge_runs (struct indexrun *runs, int nruns, FILE *out) {
+  struct indexrun *lowest;
+  int i;
+  for (;;) {
+    lowest = NULL;
+    for (i = 0; i < nruns; i++)
+      if (!runs[i].done && (!lowest || compare_entries(&runs[i].next, &lowest->next) < 0))
+        lowest = &runs[i];
+    if (!lowest)
+      return 0;
+    if (fwrite(&lowest->next, sizeof(lowest->next), 1, out) != 1)
+      return PGN2FEN_EWRITE;
+    lowest->done = (fread(&lowest->next, sizeof(lowest->next), 1, lowest->f) != 1);
+  }
+}
+
+/* Replay every game of "pgnpath" and write the index of all their positions to "indexpath". Games with a move */
+/* that can't be played are indexed up to that move. The PGN has to be a regular file, we need to come back to it */
+int pgn2fen_index_build (const char *pgnpath, const char *indexpath) {
+
+  struct pgn2fen_input in;
+  struct pgn2fen_game g;
+  struct pgn2fen_indexentry *entries;
+  struct indexrun *runs = NULL;
+  struct indexheader header;
+  struct stat st;
+  FILE *out = NULL;
+  size_t n = 0;
+  int nruns = 0, error, i, moved;
+
+  if ((error = pgn2fen_open(pgnpath, &in)) < 0)
+    return error;
+  if (!in.mapped || fstat(in.fd, &st) < 0) {
+    pgn2fen_close(&in);
+    return PGN2FEN_EOPEN;
+  }
+  if (in.binary) { /* Offsets in it are offsets in the PGN it came from */
+    pgn2fen_close(&in);
+    return PGN2FEN_EFORMAT;
+  }
+  if ((entries = malloc(INDEXRUN * sizeof(*entries))) == NULL) {
+    pgn2fen_close(&in);
+    return PGN2FEN_ENOMEM;
+  }
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, INDEXMAGIC, sizeof(header.magic));
+  header.pgnsize = st.st_size;
+  header.pgnmtime = st.st_mtime;
+
+  /* Every position after the first move of every game. The initial position is in all of them */
+  for (error = 0; !error; ) {
+    pgn2fen_init_game(&g);
+    while ((moved = pgn2fen_next_move(&in, &g, 1)) > 0 && g.ply <= INDEXMAXPLY) {
+      if (n == INDEXRUN) {
+        if ((error = spill_run(entries, n, &runs, &nruns)) < 0)
+          break;
+        n = 0;
+      }
+      entries[n].key = g.pos.key;
+      entries[n].where = ((uint64_t) g.offset << 16) | g.ply;
+      n++;
+      header.count++;
+    }
+    if (!g.started)
+      break;
+    if (moved != 0) /* Read past the rest of it */
+      pgn2fen_skip_game(&in, &g);
+  }
+  if (!error)
+    error = in.error;
+
+  /* One run is sorted in place, more than that are merged */
+  if (!error && nruns && n)
+    error = spill_run(entries, n, &runs, &nruns);
+  else if (!error)
+    qsort(entries, n, sizeof(*entries), compare_entries);
+  if (!error && (out = fopen(indexpath, "wb")) == NULL)
+    error = PGN2FEN_EWRITE;
+  if (!error && fwrite(&header, sizeof(header), 1, out) != 1)
+    error = PGN2FEN_EWRITE;
+  if (!error && nruns)
+    error = merge_runs(runs, nruns, out);
+  else if (!error && fwrite(entries, sizeof(*entries), n, out) != n)
+    error = PGN2FEN_EWRITE;
+  if (out && fclose(out) != 0 && !error)
+    error = PGN2FEN_EWRITE;
+  if (error && out)
+    unlink(indexpath);
+
+  for (i = 0; i < nruns; i++)
+    fclose(runs[i].f);
+  free(runs);
+  free(entries);
+  pgn2fen_close(&in);
+  return error;
+}
+
+/* Map the index "indexpath" of "pgnpath". Returns PGN2FEN_ESTALE if the PGN changed since it was built */
+int pgn2fen_index_open (const char *indexpath, const char *pgnpath, struct pgn2fen_index *idx) {
+
+  const struct indexheader *header;
+  struct stat st, pgnst;
+  void *map;
+  int fd;
+
+  memset(idx, 0, sizeof(*idx));
+  if (stat(pgnpath, &pgnst) < 0 || (fd = open(indexpath, O_RDONLY)) < 0)
+    return PGN2FEN_EOPEN;
+  if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(struct indexheader)) {
+    close(fd);
+    return PGN2FEN_EFORMAT;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); /* The mapping stays */
+  if (MAP_FAILED == map)
+    return PGN2FEN_EREAD;
+  madvise(map, st.st_size, MADV_RANDOM); /* We only touch the pages the binary search lands on */
+  header = map;
+  if (memcmp(header->magic, INDEXMAGIC, sizeof(header->magic)) ||
+      st.st_size != (off_t) (sizeof(*header) + header->count * sizeof(struct pgn2fen_indexentry))) {
+    munmap(map, st.st_size);
+    return PGN2FEN_EFORMAT;
+  }
+  if (header->pgnsize != (uint64_t) pgnst.st_size || header->pgnmtime != (int64_t) pgnst.st_mtime) {
+    munmap(map, st.st_size);
+    return PGN2FEN_ESTALE;
+  }
+  idx->map = map;
+  idx->mapsize = st.st_size;
+  idx->entries = (const struct pgn2fen_indexentry *) (header + 1);
+  idx->count = header->count;
+  return 0;
+}
+
+/* The entries for "key". "first" gets the first of them, the rest follow it. Returns how many there are */
+size_t pgn2fen_index_find (const struct pgn2fen_index *idx, uint64_t key, const struct pgn2fen_indexentry **first) {
+  size_t low = 0, high = idx->count, mid, n;
+  while (low < high) { /* The first entry that isn't lower than "key" */
+    mid = low + (high - low) / 2;
+    if (idx->entries[mid].key < key)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  for (n = 0; low + n < idx->count && idx->entries[low + n].key == key; n++);
+  *first = idx->entries + low;
+  return n;
+}
+
+void pgn2fen_index_close (struct pgn2fen_index *idx) {
+  if (idx->map)
+    munmap(idx->map, idx->mapsize);
+  memset(idx, 0, sizeof(*idx));
+}
@@ -6,38 +6,1398 @@
  *  -------------------------------------------------------
  *
  *  Usage:
- *  pgn2fen input_game.pgn move [w/b] [output_position.fen]
+ *  pgn2fen [-d [-j jobs]] [-a [-u move[w/b]]] [-V] [-k|-K] [-g game] [--where filter] input_game.pgn move [w/b] [output_position.fen]
+ *  pgn2fen -b [output_position.fen]
+ *  pgn2fen -i index input_game.pgn
+ *  pgn2fen -q index input_game.pgn fen [output_position.fen]
+ *  pgn2fen -c binary input_game.pgn
+ *  pgn2fen -p depth [fen]
+ *  pgn2fen -s fen [-k|-K] [--where filter] input_game.pgn [output.txt]
+ *  pgn2fen -U [-j jobs] [-m megabytes] [-k|-K] [--where filter] input_game.pgn [output.txt]
+ *  pgn2fen -f [-k|-K] input_game.pgn [output.txt]
+ *  Any of the first one with --stats[=json]
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "pgn2fen.h"
 
 #define NARGS 2            /* Mandatory arguments */
 #define NARGSOPT 2        /* Optional arguments */
-#define FILES 8            /* Board files (columns) (a-h) */
-#define RANKS 8            /* Board ranks (rows) (1-8) */
-#define CASTLEK (1 << 3)  /* White can castle Kingside */
-#define CASTLEQ (1 << 2)  /* White can castle Queenside */
-#define CASTLEk (1 << 1)  /* Black can castle Kingside */
-#define CASTLEq 1         /* Black can castle Queenside */
-#define WHITE 1            /* Used to determine which turn... */
-#define BLACK 0            /* ...is whilst traversing the list of moves */
+#define CHUNKSIZE (1 << 20) /* With -j the database is cut in pieces about this big */
+#define CHUNKWINDOW 4      /* How many chunks per thread can be waiting to be written out */
+#define BATCHFILES 16      /* Files kept open in batch mode */
+#define BATCHGAMES 64      /* Replayed games kept in batch mode */
+#define LINESIZE (PGN2FEN_FENSIZE + 64 + 24 * PGN2FEN_MAXNESTING) /* Room for a line of output: the FEN and what comes before it */
+#define OUTPUTBUFFER (1 << 20) /* Output is written in pieces this big */
+#define UNIQUEMEMORY 1024  /* Megabytes of tables for -U, unless we are told otherwise */
+#define KEYS_NONE 0        /* Print the FEN only... */
+#define KEYS_TOO 1         /* ...the Zobrist key and the FEN... */
+#define KEYS_ONLY 2        /* ...or only the key */
+#define STATS_TEXT 1       /* --stats, for people... */
+#define STATS_JSON 2       /* ...and --stats=json, for programs */
+
+/* What we have been asked to print */
+struct options {
+  int first, last; /* Plies of the first and last positions we print */
+  int database; /* Lines begin with the game number and offset */
+  int allplies; /* Number each position, we print more than one per game */
+  int variations; /* Follow the variations too, each line says which one it is */
+  int keys; /* KEYS_NONE, KEYS_TOO or KEYS_ONLY */
+  int threads;
+  int stats; /* 0, STATS_TEXT or STATS_JSON */
+};
+
+/* Where the time went, for --stats. Each thread adds up its own, and they are put together at the end. */
+/* Loading is opening and reading the input (or waiting for the decompressor), which the library times. */
+/* Replaying a game is timed as a whole, and the reading done meanwhile and the time spent writing lines */
+/* are taken out. Writing a line is too quick to ask the CPU clock of the thread, which takes longer than */
+/* the line, so its CPU time is taken to be its wall time */
+struct phases {
+  double replaywall, replaycpu, serializewall, serializecpu;
+};
+
+static __thread struct phases phases;
+
+static struct {
+  struct pgn2fen_stats lib;
+  struct phases phases;
+  pthread_mutex_t lock;
+} report = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/* Seconds gone by, and seconds of CPU used by this thread if "cpu" isn't NULL */
+static double clocks (double *cpu) {
+  struct timespec t;
+  if (cpu) {
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+    *cpu = t.tv_sec + t.tv_nsec / 1e9;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* A game was replayed in "wall" and "cpu" seconds, "linewall" of them writing lines. "before" is what the */
+/* library had counted when it began */
+static void time_game (const struct pgn2fen_stats *before, double wall, double cpu, double linewall) {
+  struct pgn2fen_stats after;
+  double now, nowcpu, linecpu;
+  now = clocks(&nowcpu);
+  memset(&after, 0, sizeof(after));
+  pgn2fen_stats(&after);
+  wall = now - wall - (after.readwall - before->readwall);
+  cpu = nowcpu - cpu - (after.readcpu - before->readcpu);
+  linecpu = (linewall < cpu)?linewall:cpu;
+  phases.serializewall += linewall;
+  phases.serializecpu += linecpu;
+  phases.replaywall += wall - linewall;
+  phases.replaycpu += cpu - linecpu;
+}
+
+/* This thread is done, put what it counted with the rest */
+static void gather_stats (void) {
+  pthread_mutex_lock(&report.lock);
+  pgn2fen_stats(&report.lib);
+  report.phases.replaywall += phases.replaywall;
+  report.phases.replaycpu += phases.replaycpu;
+  report.phases.serializewall += phases.serializewall;
+  report.phases.serializecpu += phases.serializecpu;
+  pthread_mutex_unlock(&report.lock);
+}
+
+/* Print the report to stderr, stdout has the positions. "wall" is how long we ran. With -j the times of */
+/* the phases are added up over the threads, so together they can be longer than that */
+static void print_stats (int format, double wall) {
+  static const char *names[6] = { "pawn", "knight", "bishop", "rook", "queen", "king" };
+  const struct pgn2fen_stats *l = &report.lib;
+  const struct phases *ph = &report.phases;
+  struct timespec t;
+  double cpu;
+  int i;
+
+  gather_stats();
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t);
+  cpu = t.tv_sec + t.tv_nsec / 1e9;
+  if (STATS_JSON == format) {
+    fprintf(stderr, "{\"wall\": %.6f, \"cpu\": %.6f, \"phases\": {", wall, cpu);
+    fprintf(stderr, "\"load\": {\"wall\": %.6f, \"cpu\": %.6f}, ", l->openwall + l->readwall, l->opencpu + l->readcpu);
+    fprintf(stderr, "\"replay\": {\"wall\": %.6f, \"cpu\": %.6f}, ", ph->replaywall, ph->replaycpu);
+    fprintf(stderr, "\"serialize\": {\"wall\": %.6f, \"cpu\": %.6f}}, ", ph->serializewall, ph->serializecpu);
+    fprintf(stderr, "\"bytes\": %llu, \"tokens\": %llu, \"plies\": %llu, \"tagbytes\": %llu, \"commentbytes\": %llu, ",
+            (unsigned long long) l->bytes, (unsigned long long) l->tokens, (unsigned long long) l->plies,
+            (unsigned long long) l->tagbytes, (unsigned long long) l->commentbytes);
+    fprintf(stderr, "\"pieces\": {");
+    for (i = 0; i < 6; i++)
+      fprintf(stderr, "%s\"%s\": {\"moves\": %llu, \"candidates\": %llu, \"disambiguated\": %llu}", (i)?", ":"", names[i],
+              (unsigned long long) l->resolved[i], (unsigned long long) l->candidates[i], (unsigned long long) l->disambiguated[i]);
+    fprintf(stderr, "}, \"castles\": %llu, \"enpassant\": %llu, \"promotions\": %llu, \"doublepushes\": %llu}\n",
+            (unsigned long long) l->castles, (unsigned long long) l->enpassant, (unsigned long long) l->promotions,
+            (unsigned long long) l->doublepushes);
+    return;
+  }
+  fprintf(stderr, "%-14s %12s %12s\n", "phase", "wall s", "cpu s");
+  fprintf(stderr, "%-14s %12.6f %12.6f\n", "load", l->openwall + l->readwall, l->opencpu + l->readcpu);
+  fprintf(stderr, "%-14s %12.6f %12.6f\n", "replay", ph->replaywall, ph->replaycpu);
+  fprintf(stderr, "%-14s %12.6f %12.6f\n", "serialize", ph->serializewall, ph->serializecpu);
+  fprintf(stderr, "%-14s %12.6f %12.6f\n\n", "total", wall, cpu);
+  fprintf(stderr, "%-14s %12llu\n", "bytes read", (unsigned long long) l->bytes);
+  fprintf(stderr, "%-14s %12llu\n", "tokens", (unsigned long long) l->tokens);
+  fprintf(stderr, "%-14s %12llu\n", "plies", (unsigned long long) l->plies);
+  fprintf(stderr, "%-14s %12llu\n", "tag bytes", (unsigned long long) l->tagbytes);
+  fprintf(stderr, "%-14s %12llu\n\n", "comment bytes", (unsigned long long) l->commentbytes);
+  fprintf(stderr, "%-14s %12s %12s %14s\n", "piece", "moves", "candidates", "disambiguated");
+  for (i = 0; i < 6; i++)
+    fprintf(stderr, "%-14s %12llu %12llu %14llu\n", names[i], (unsigned long long) l->resolved[i],
+            (unsigned long long) l->candidates[i], (unsigned long long) l->disambiguated[i]);
+  fprintf(stderr, "\n%-14s %12llu\n%-14s %12llu\n%-14s %12llu\n%-14s %12llu\n", "castles", (unsigned long long) l->castles,
+          "en passant", (unsigned long long) l->enpassant, "promotions", (unsigned long long) l->promotions,
+          "double pushes", (unsigned long long) l->doublepushes);
+}
+
+/* There's no memory left, nothing else can be done */
+static void out_of_memory (void) {
+  printf("*** Error: %s\n", pgn2fen_strerror(PGN2FEN_ENOMEM));
+  exit(EXIT_FAILURE);
+}
+
+/* realloc, giving up if there's no memory for it */
+static void *resize (void *p, size_t size) {
+  void *tmp;
+  if ((tmp = realloc(p, size)) == NULL)
+    out_of_memory();
+  return tmp;
+}
+
+/* Write "n" in decimal at "p". Returns where it ends */
+static char *write_number (char *p, unsigned long long n) {
+  char digits[20];
+  int i = 0;
+  do {
+    digits[i++] = '0' + n % 10;
+  } while (n /= 10);
+  while (i)
+    *p++ = digits[--i];
+  return p;
+}
+
+/* Write the position the way we were asked to at "p": its FEN, its key, or both, and the end of the */
+/* line. There must be room for LINESIZE bytes. Returns where it ends */
+static char *write_position (char *p, const struct options *opts, const struct pgn2fen_position *pos) {
+  int i;
+  if (opts->keys != KEYS_NONE) {
+    for (i = 60; i >= 0; i -= 4)
+      *p++ = "0123456789abcdef"[(pos->key >> i) & 0xF];
+    if (KEYS_TOO == opts->keys)
+      *p++ = ' ';
+  }
+  if (opts->keys != KEYS_ONLY)
+    p += pgn2fen_fen(pos, p, PGN2FEN_FENSIZE);
+  *p++ = '\n';
+  return p;
+}
+
+/* Print the FEN of the position */
+static void print_fen (FILE *foutput, const struct pgn2fen_position *pos) {
+  char line[LINESIZE];
+  struct options opts = { 0 };
+  fwrite(line, 1, write_position(line, &opts, pos) - line, foutput);
+}
+
+/* Write which variation we are in, like "7.1,9.2": for each one from the main line in, the ply of the move */
+/* it replaces and which of the variations replacing that move it is. The main line is "0" */
+static char *write_variation (char *p, const struct pgn2fen_variations *v) {
+  int i;
+  if (!v->depth)
+    *p++ = '0';
+  for (i = 0; i < v->depth; i++) {
+    if (i)
+      *p++ = ',';
+    p = write_number(p, v->stack[i].ply);
+    *p++ = '.';
+    p = write_number(p, v->stack[i].number);
+  }
+  return p;
+}
+
+/* Play the next game of "in" as we read it, printing the FEN after each ply from opts->first to */
+/* opts->last. Once we are done printing, the rest of the game is only skimmed to land on the next one, */
+/* unless "stop" is set. With -d the lines begin with the game number (if it's not 0) and its offset. */
+/* With -V the whole game is read, variations included, and the positions of every line are printed */
+/* Returns the number of plies played or -1 if there are no more games. "illegal" is set if a move couldn't be played */
+static int play_game (struct pgn2fen_input *in, FILE *foutput, const struct options *opts, int game, int stop, size_t *offset, int *illegal) {
+
+  struct pgn2fen_game g;
+  struct pgn2fen_variations v;
+  struct pgn2fen_stats before;
+  char line[LINESIZE], *p;
+  double wall = 0, cpu = 0, linewall = 0, linestart = 0;
+  int moved = 0;
+
+  if (opts->stats) {
+    memset(&before, 0, sizeof(before));
+    pgn2fen_stats(&before);
+    wall = clocks(&cpu);
+  }
+  pgn2fen_init_game(&g);
+  if (opts->variations)
+    pgn2fen_init_variations(&v);
+  *illegal = 0;
+  while ((opts->variations || g.ply < opts->last) &&
+         (moved = (opts->variations)?pgn2fen_next_variation_move(in, &g, &v):pgn2fen_next_move(in, &g, 1)) > 0)
+    if (g.ply >= opts->first && g.ply <= opts->last) { /* The whole line is put together here and goes out in one go */
+      if (opts->stats)
+        linestart = clocks(NULL);
+      p = line;
+      if (opts->database && game) {
+        p = write_number(p, game);
+        *p++ = ' ';
+      }
+      if (opts->database) {
+        p = write_number(p, g.offset);
+        *p++ = ' ';
+      }
+      if (opts->variations) {
+        p = write_variation(p, &v);
+        *p++ = ' ';
+      }
+      if (opts->allplies) {
+        p = write_number(p, g.ply);
+        *p++ = ' ';
+      }
+      p = write_position(p, opts, &g.pos);
+      fwrite(line, 1, p - line, foutput);
+      if (opts->stats)
+        linewall += clocks(NULL) - linestart;
+    }
+  *illegal = (PGN2FEN_ESAN == moved || PGN2FEN_EILLEGAL == moved);
+  if (opts->variations && v.errors)
+    fprintf(stderr, "*** Warning: In the game at offset %zu, %d variation(s) have a move that can't be played, skipping the rest of them\n", g.offset, v.errors);
+  if (!stop)
+    pgn2fen_skip_game(in, &g);
+  if (opts->stats)
+    time_game(&before, wall, cpu, linewall);
+  *offset = g.offset;
+  return (g.started)?g.ply:-1;
+}
+
+/* The lines a game printed. Used when games are numbered after the fact */
+struct gamelines {
+  int game; /* Counting from the beginning of the chunk */
+  size_t start, end; /* Where they are in the output */
+};
+
+/* A piece of the database, it's made of whole games */
+struct chunk {
+  size_t start, end; /* Bytes of the file it covers */
+  char *out; /* What it printed */
+  size_t outlen;
+  struct gamelines *lines;
+  int nlines, games;
+  int *illegal; /* Games with a move that can't be played, warned about when they are numbered */
+  int nillegal;
+  int done;
+};
+
+/* Make room for one more in "list", which has "count" things of "size" bytes. It grows 64 at a time */
+static void *grow_list (void *list, int count, size_t size) {
+  return (count % 64)?list:resize(list, (count + 64) * size);
+}
+
+static void warn_illegal (int game) {
+  fprintf(stderr, "*** Warning: Game %d has a move that can't be played, skipping the rest of it\n", game);
+}
+
+/* Print the positions of every game in "in", numbering the games from "game". If "chunk" is given the game */
+/* numbers are left out and the lines of each game are recorded, so they can be numbered later on */
+/* Returns the number of games */
+static int process_games (struct pgn2fen_input *in, FILE *foutput, const struct options *opts, int game, struct chunk *chunk) {
+
+  size_t offset; /* Where the game begins */
+  long start = 0;
+  int games = 0, illegal;
+
+  for (;;) {
+    if (chunk)
+      start = ftell(foutput);
+    if (play_game(in, foutput, opts, (chunk)?0:game + games, 0, &offset, &illegal) < 0)
+      break;
+    games++;
+    if (illegal) {
+      if (chunk) { /* We don't know its number yet */
+        chunk->illegal = grow_list(chunk->illegal, chunk->nillegal, sizeof(int));
+        chunk->illegal[chunk->nillegal++] = games - 1;
+      } else
+        warn_illegal(game + games - 1);
+    }
+    if (chunk && ftell(foutput) > start) {
+      chunk->lines = grow_list(chunk->lines, chunk->nlines, sizeof(struct gamelines));
+      chunk->lines[chunk->nlines].game = games - 1;
+      chunk->lines[chunk->nlines].start = start;
+      chunk->lines[chunk->nlines].end = ftell(foutput);
+      chunk->nlines++;
+    }
+  }
+  return games;
+}
+
+
+/* Threads taking chunks from their own queue, and from the others' when theirs is empty */
+struct worker {
+  pthread_t thread;
+  int *queue; /* Chunks, lowest first */
+  int head, tail;
+  pthread_mutex_t lock;
+  struct pool *pool;
+};
+
+struct pool {
+  const struct pgn2fen_input *in;
+  const struct options *opts;
+  struct chunk *chunks;
+  int nchunks;
+  struct worker *workers;
+  int flushed; /* Chunks already written out */
+  pthread_mutex_t lock; /* Protects "flushed" and the chunks' "done" */
+  pthread_cond_t cond;
+};
+
+static int take_chunk (struct worker *w) {
+  int c = -1;
+  pthread_mutex_lock(&w->lock);
+  if (w->head < w->tail)
+    c = w->queue[w->head++];
+  pthread_mutex_unlock(&w->lock);
+  return c;
+}
+
+/* Our queue is empty, steal the lowest chunk someone else hasn't started yet. Output goes out in order, */
+/* so the lowest chunks are the ones holding everybody back */
+static int steal_chunk (struct worker *self) {
+  struct pool *pool = self->pool;
+  struct worker *victim = NULL;
+  int i, c = -1;
+  for (i = 0; i < pool->opts->threads; i++) {
+    pthread_mutex_lock(&pool->workers[i].lock);
+    if (pool->workers[i].head < pool->workers[i].tail && (c < 0 || pool->workers[i].queue[pool->workers[i].head] < c)) {
+      c = pool->workers[i].queue[pool->workers[i].head];
+      victim = &pool->workers[i];
+    }
+    pthread_mutex_unlock(&pool->workers[i].lock);
+  }
+  if (victim) { /* It could have been taken in the meantime, so try again if it was */
+    pthread_mutex_lock(&victim->lock);
+    c = (victim->head < victim->tail && victim->queue[victim->head] == c)?victim->queue[victim->head++]:-2;
+    pthread_mutex_unlock(&victim->lock);
+    if (-2 == c)
+      return steal_chunk(self);
+  }
+  return c;
+}
+
+static void *work (void *arg) {
+  struct worker *w = arg;
+  struct pool *pool = w->pool;
+  struct pgn2fen_input in;
+  struct chunk *chunk;
+  FILE *out;
+  int c;
+
+  while ((c = take_chunk(w)) >= 0 || (c = steal_chunk(w)) >= 0) {
+    chunk = &pool->chunks[c];
+    /* Don't get too far ahead of the output, or we would keep the whole thing in memory */
+    pthread_mutex_lock(&pool->lock);
+    while (c >= pool->flushed + CHUNKWINDOW * pool->opts->threads)
+      pthread_cond_wait(&pool->cond, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+
+    in = *pool->in; /* The same file, only this chunk of it */
+    in.pos = chunk->start;
+    in.size = chunk->end;
+    if ((out = open_memstream(&chunk->out, &chunk->outlen)) == NULL)
+      out_of_memory();
+    chunk->games = process_games(&in, out, pool->opts, 0, chunk);
+    fclose(out);
+
+    pthread_mutex_lock(&pool->lock);
+    chunk->done = 1;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+  }
+  if (pool->opts->stats)
+    gather_stats();
+  return NULL;
+}
+
+/* Same as process_games, but the file is cut into chunks at game boundaries and the chunks are spread */
+/* among "threads" workers. Each chunk prints to memory and we write them out in order, numbering the games */
+static void process_games_parallel (struct pgn2fen_input *in, FILE *foutput, const struct options *opts) {
+
+  struct pool pool;
+  struct chunk *chunk;
+  size_t start, end, line, eol;
+  char number[24], *p;
+  double wall = 0, cpu = 0, nowcpu;
+  int i, j, game = 1;
+
+  memset(&pool, 0, sizeof(pool));
+  pool.in = in;
+  pool.opts = opts;
+  pthread_mutex_init(&pool.lock, NULL);
+  pthread_cond_init(&pool.cond, NULL);
+
+  /* Cut the file. The first chunk starts at 0, whatever comes before the first tag belongs to it */
+  for (start = 0; start < in->size; start = end) {
+    end = (start + CHUNKSIZE < in->size)?pgn2fen_next_game_start(in, start + CHUNKSIZE):in->size;
+    if (pool.nchunks % 256 == 0)
+      pool.chunks = resize(pool.chunks, (pool.nchunks + 256) * sizeof(struct chunk));
+    memset(&pool.chunks[pool.nchunks], 0, sizeof(struct chunk));
+    pool.chunks[pool.nchunks].start = start;
+    pool.chunks[pool.nchunks].end = end;
+    pool.nchunks++;
+  }
+
+  /* Deal them like cards, so everybody starts near the beginning */
+  if ((pool.workers = calloc(opts->threads, sizeof(struct worker))) == NULL)
+    out_of_memory();
+  for (i = 0; i < opts->threads; i++) {
+    if ((pool.workers[i].queue = malloc((pool.nchunks / opts->threads + 1) * sizeof(int))) == NULL)
+      out_of_memory();
+    for (j = i; j < pool.nchunks; j += opts->threads)
+      pool.workers[i].queue[pool.workers[i].tail++] = j;
+    pool.workers[i].pool = &pool;
+    pthread_mutex_init(&pool.workers[i].lock, NULL);
+  }
+  for (i = 0; i < opts->threads; i++)
+    if (pthread_create(&pool.workers[i].thread, NULL, work, &pool.workers[i]) != 0) {
+      printf("*** Error: Could not start the worker threads\n");
+      exit(EXIT_FAILURE);
+    }
+
+  /* Write out the chunks as they are finished, in order */
+  for (i = 0; i < pool.nchunks; i++) {
+    chunk = &pool.chunks[i];
+    pthread_mutex_lock(&pool.lock);
+    while (!chunk->done)
+      pthread_cond_wait(&pool.cond, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+    if (opts->stats)
+      wall = clocks(&cpu);
+    for (j = 0; j < chunk->nillegal; j++)
+      warn_illegal(game + chunk->illegal[j]);
+    for (j = 0; j < chunk->nlines; j++) /* Every line gets its game number */
+      for (line = chunk->lines[j].start; line < chunk->lines[j].end; line = eol) {
+        eol = (char *) memchr(chunk->out + line, '\n', chunk->lines[j].end - line) - chunk->out + 1;
+        p = write_number(number, game + chunk->lines[j].game);
+        *p++ = ' ';
+        fwrite(number, 1, p - number, foutput);
+        fwrite(chunk->out + line, 1, eol - line, foutput);
+      }
+    if (opts->stats) {
+      phases.serializewall += clocks(&nowcpu) - wall;
+      phases.serializecpu += nowcpu - cpu;
+    }
+    game += chunk->games;
+    free(chunk->out);
+    free(chunk->lines);
+    free(chunk->illegal);
+    pthread_mutex_lock(&pool.lock);
+    pool.flushed = i + 1;
+    pthread_cond_broadcast(&pool.cond);
+    pthread_mutex_unlock(&pool.lock);
+  }
+
+  for (i = 0; i < opts->threads; i++) {
+    pthread_join(pool.workers[i].thread, NULL);
+    pthread_mutex_destroy(&pool.workers[i].lock);
+    free(pool.workers[i].queue);
+  }
+  free(pool.workers);
+  free(pool.chunks);
+  pthread_cond_destroy(&pool.cond);
+  pthread_mutex_destroy(&pool.lock);
+}
+
+/* The distinct positions of a database, gathered by threads taking chunks of it in turn */
+struct unique {
+  struct pgn2fen_input *in;
+  struct pgn2fen_set set;
+  struct chunk *chunks; /* Only their bytes, games and games with a move that can't be played are used */
+  int nchunks;
+  int next; /* The next chunk nobody took yet */
+  int error;
+};
+
+/* Add every position of every game of "in" to the set, after each move. Games with a move that can't be */
+/* played are warned about like with -d, right away, or once they can be numbered if "chunk" is given */
+static int unique_games (struct unique *u, struct pgn2fen_input *in, struct chunk *chunk) {
+  struct pgn2fen_game g;
+  int moved, error, games = 0;
+  for (;;) {
+    pgn2fen_init_game(&g);
+    while ((moved = pgn2fen_next_move(in, &g, 1)) > 0)
+      if ((error = pgn2fen_set_add(&u->set, &g.pos)) < 0)
+        return error;
+    if (!g.started)
+      return in->error;
+    games++;
+    if (chunk)
+      chunk->games = games;
+    if (PGN2FEN_ESAN == moved || PGN2FEN_EILLEGAL == moved) {
+      if (chunk) {
+        chunk->illegal = grow_list(chunk->illegal, chunk->nillegal, sizeof(int));
+        chunk->illegal[chunk->nillegal++] = games - 1;
+      } else
+        warn_illegal(games);
+    }
+    if (moved != 0)
+      pgn2fen_skip_game(in, &g);
+  }
+}
+
+static void *unique_work (void *arg) {
+  struct unique *u = arg;
+  struct pgn2fen_input in;
+  int c, error = 0;
+  while (!error && (c = __atomic_fetch_add(&u->next, 1, __ATOMIC_RELAXED)) < u->nchunks) {
+    in = *u->in;
+    in.pos = u->chunks[c].start;
+    in.size = u->chunks[c].end;
+    error = unique_games(u, &in, &u->chunks[c]);
+  }
+  if (error)
+    __atomic_store_n(&u->error, error, __ATOMIC_RELAXED);
+  return NULL;
+}
+
+/* Print each distinct position reached in the games of "in" once, after every move of every game, with how */
+/* many times it was reached: "count FEN", the FEN without its clocks, they aren't part of the position. */
+/* The games are replayed on "threads" threads into the same set, which uses up to "budget" bytes of memory */
+/* and spills sorted runs to temporary files beyond that. The positions come out in order of their keys */
+static void unique_positions (struct pgn2fen_input *in, FILE *foutput, const struct options *opts, size_t budget) {
+
+  struct unique u;
+  struct pgn2fen_position pos;
+  pthread_t *threads;
+  char line[LINESIZE], *p;
+  uint64_t count;
+  size_t start, end;
+  int i, j, spaces, error, game;
+
+  memset(&u, 0, sizeof(u));
+  u.in = in;
+  if ((error = pgn2fen_set_open(&u.set, budget)) < 0) {
+    printf("*** Error: %s\n", pgn2fen_strerror(error));
+    exit(EXIT_FAILURE);
+  }
+  if (1 == opts->threads || in->binary) /* Binary databases have no tags to cut them at */
+    u.error = unique_games(&u, in, NULL);
+  else {
+    while (pgn2fen_refill(in)); /* We need all of it to cut it in pieces */
+    for (start = in->pos; start < in->size; start = end) {
+      end = (start + CHUNKSIZE < in->size)?pgn2fen_next_game_start(in, start + CHUNKSIZE):in->size;
+      if (u.nchunks % 256 == 0)
+        u.chunks = resize(u.chunks, (u.nchunks + 256) * sizeof(struct chunk));
+      memset(&u.chunks[u.nchunks], 0, sizeof(struct chunk));
+      u.chunks[u.nchunks].start = start;
+      u.chunks[u.nchunks].end = end;
+      u.nchunks++;
+    }
+    if ((threads = malloc(opts->threads * sizeof(pthread_t))) == NULL)
+      out_of_memory();
+    for (i = 0; i < opts->threads; i++)
+      if (pthread_create(&threads[i], NULL, unique_work, &u) != 0) {
+        printf("*** Error: Could not start the worker threads\n");
+        exit(EXIT_FAILURE);
+      }
+    for (i = 0; i < opts->threads; i++)
+      pthread_join(threads[i], NULL);
+    free(threads);
+    for (i = 0, game = 1; i < u.nchunks; game += u.chunks[i++].games) { /* Now the games have their numbers */
+      for (j = 0; j < u.chunks[i].nillegal; j++)
+        warn_illegal(game + u.chunks[i].illegal[j]);
+      free(u.chunks[i].illegal);
+    }
+    free(u.chunks);
+  }
+  if (u.error || (u.error = in->error) || (u.error = pgn2fen_set_finish(&u.set)) < 0) {
+    printf("*** Error: %s\n", pgn2fen_strerror(u.error));
+    exit(EXIT_FAILURE);
+  }
+
+  while (pgn2fen_set_next(&u.set, &pos, &count) > 0) {
+    p = write_number(line, count);
+    *p++ = ' ';
+    p = write_position(p, opts, &pos) - 1; /* At the end of the line */
+    if (opts->keys != KEYS_ONLY) /* Without the clocks */
+      for (spaces = 0; spaces < 2; )
+        spaces += (' ' == *--p);
+    *p = '\n';
+    fwrite(line, 1, p + 1 - line, foutput);
+  }
+  pgn2fen_set_close(&u.set);
+}
+
+/* A file we answer queries about, in batch mode */
+struct batchfile {
+  char *path;
+  struct pgn2fen_input in;
+  size_t *games; /* Where each game begins, as far as we have read */
+  int ngames, size;
+  size_t scanned; /* Where we stopped looking for games */
+  int complete; /* We know where all of them are */
+  unsigned long used; /* When it was last used, to throw out the oldest */
+};
+
+/* A game we have replayed in batch mode. Later queries about it carry on from where it stopped */
+struct batchgame {
+  struct batchfile *file;
+  int number;
+  struct pgn2fen_game g;
+  unsigned long used;
+};
+
+struct batch {
+  struct batchfile files[BATCHFILES];
+  struct batchgame games[BATCHGAMES];
+  unsigned long clock;
+};
+
+/* The file called "path", opening it if it isn't already. Returns NULL if it can't be used, after */
+/* saying why on "foutput" */
+static struct batchfile *batch_file (struct batch *b, FILE *foutput, const char *path) {
+
+  struct batchfile *f, *oldest = &b->files[0];
+  int i;
+
+  for (i = 0; i < BATCHFILES; i++) {
+    f = &b->files[i];
+    if (f->path && !strcmp(f->path, path)) {
+      f->used = ++b->clock;
+      return f;
+    }
+    if (f->used < oldest->used)
+      oldest = f;
+  }
+  /* Make room, the games we kept from it are gone too */
+  f = oldest;
+  if (f->path) {
+    for (i = 0; i < BATCHGAMES; i++)
+      if (b->games[i].file == f)
+        b->games[i].file = NULL;
+    pgn2fen_close(&f->in);
+    free(f->path);
+    free(f->games);
+  }
+  memset(f, 0, sizeof(*f));
+  if (pgn2fen_open(path, &f->in) < 0) {
+    fprintf(foutput, "*** Error: The input file \"%s\" could not be opened\n", path);
+    return NULL;
+  }
+  if (!f->in.mapped || f->in.binary) { /* We jump back and forth, we need all of it, and PGN */
+    fprintf(foutput, "*** Error: -b needs regular uncompressed PGN files, \"%s\" isn't one\n", path);
+    pgn2fen_close(&f->in);
+    return NULL;
+  }
+  if ((f->path = strdup(path)) == NULL)
+    out_of_memory();
+  f->used = ++b->clock;
+  return f;
+}
+
+/* Where game "number" begins. Returns -1 if there aren't that many games */
+static int batch_find_game (struct batchfile *f, int number, size_t *offset) {
+
+  struct pgn2fen_game g;
+
+  while (f->ngames < number && !f->complete) { /* Look for more */
+    f->in.pos = f->scanned;
+    pgn2fen_init_game(&g);
+    pgn2fen_skip_game(&f->in, &g);
+    if (!g.started) {
+      f->complete = 1;
+      break;
+    }
+    if (f->ngames == f->size) {
+      f->size = (f->size)?2*f->size:1024;
+      f->games = resize(f->games, f->size * sizeof(size_t));
+    }
+    f->games[f->ngames++] = g.offset;
+    f->scanned = f->in.pos;
+  }
+  if (number > f->ngames)
+    return -1;
+  *offset = f->games[number-1];
+  return 0;
+}
+
+/* Answer a query: print the FEN after "ply" in game "number" of "path". If we replayed that game */
+/* lately and didn't go past "ply", we carry on from there */
+static void batch_query (struct batch *b, FILE *foutput, const char *path, int number, int ply) {
+
+  struct batchfile *f;
+  struct batchgame *e = NULL, *oldest = &b->games[0];
+  size_t offset;
+  int i, moved = 0;
+
+  if ((f = batch_file(b, foutput, path)) == NULL)
+    return;
+  if (batch_find_game(f, number, &offset) < 0) {
+    fprintf(foutput, "*** Error: Game number %d does not exist\n", number);
+    return;
+  }
+  for (i = 0; i < BATCHGAMES; i++) {
+    if (b->games[i].file == f && b->games[i].number == number) {
+      e = &b->games[i];
+      break;
+    }
+    if (b->games[i].used < oldest->used)
+      oldest = &b->games[i];
+  }
+  if (e && e->g.ply <= ply) /* Carry on */
+    f->in.pos = e->g.next;
+  else { /* From the beginning */
+    if (!e)
+      e = oldest;
+    e->file = f;
+    e->number = number;
+    pgn2fen_init_game(&e->g);
+    f->in.pos = offset;
+  }
+  e->used = ++b->clock;
+
+  while (e->g.ply < ply && (moved = pgn2fen_next_move(&f->in, &e->g, 1)) > 0);
+  if (moved < 0) {
+    e->file = NULL; /* It can't be trusted anymore */
+    fprintf(foutput, "*** Error: The game has a move that can't be played\n");
+  } else if (e->g.ply < ply)
+    fprintf(foutput, "*** Error: Move number %d by %s does not exist\n", (ply+1)/2, (ply % 2)?"white":"black");
+  else
+    print_fen(foutput, &e->g.pos);
+}
+
+/* Cut the last word off "line" and return it. NULL if it's the only word left */
+static char *last_word (char *line) {
+  char *p = line + strlen(line), *word;
+  while (p > line && !isspace((unsigned char) p[-1]))
+    p--;
+  if (p == line)
+    return NULL;
+  word = p;
+  while (p > line && isspace((unsigned char) p[-1]))
+    *--p = '\0';
+  return word;
+}
+
+/* Read queries from stdin, one per line: "file game move [w/b]", and answer each one with a line */
+static void batch (FILE *foutput) {
+
+  struct batch *b = calloc(1, sizeof(struct batch));
+  char *line = NULL, *query = NULL, *word, *game;
+  size_t size = 0;
+  int number, ply;
+  ssize_t len;
+
+  if (NULL == b)
+    out_of_memory();
+  while ((len = getline(&line, &size, stdin)) >= 0) {
+    while (len > 0 && isspace((unsigned char) line[len-1])) /* Trim it */
+      line[--len] = '\0';
+    if (0 == len)
+      continue;
+    free(query);
+    if ((query = strdup(line)) == NULL) /* For the error message, "line" gets cut in pieces */
+      out_of_memory();
+    /* The file name may have spaces, so we take the fields from the end */
+    number = ply = 0;
+    if ((word = last_word(line)) != NULL && 1 == strlen(word) && strchr("wb", tolower(word[0]))) {
+      ply = ('b' == tolower(word[0]))?1:0;
+      word = last_word(line);
+    }
+    if (word && (game = last_word(line)) != NULL) {
+      number = atoi(game);
+      ply += 2*atoi(word) - 1;
+    }
+    if (number <= 0 || ply <= 0)
+      fprintf(foutput, "*** Error: Invalid query \"%s\"\n", query);
+    else
+      batch_query(b, foutput, line, number, ply);
+    fflush(foutput); /* Somebody is waiting for it */
+  }
+  free(query);
+  free(line);
+}
+
+/* A file growing as games are played, like a tournament relay, and how far we read it. Only the bytes */
+/* added since the last time are read, picking up the game we were in where we left it */
+struct follow {
+  const char *path;
+  int fd;
+  dev_t dev; /* The file we have open, to notice if it's replaced by a new one */
+  ino_t inode;
+  size_t done; /* Bytes we are through with, up to the end of the last token we used */
+  char *buf; /* What was added since */
+  size_t cap;
+  struct pgn2fen_game g; /* The game we are in, as far as it got */
+  int game; /* Its number */
+  int broken; /* It has a move that can't be played, we wait for the next one */
+  int *printed; /* Plies of each game we printed, so a file written again from the start doesn't repeat them */
+  int ngames;
+};
+
+/* (Re)open the file and start again from its beginning */
+static int follow_open (struct follow *f) {
+  struct stat st;
+  if (f->fd >= 0)
+    close(f->fd);
+  if ((f->fd = open(f->path, O_RDONLY)) < 0 || fstat(f->fd, &st) < 0)
+    return 0;
+  f->dev = st.st_dev;
+  f->inode = st.st_ino;
+  f->done = 0;
+  f->game = 1;
+  f->broken = 0;
+  pgn2fen_init_game(&f->g);
+  return 1;
+}
+
+/* Play what was added to the file since last time, printing a line for each move as in -d -a */
+static void follow_read (struct follow *f, FILE *foutput, const struct options *opts) {
+
+  struct pgn2fen_input in;
+  struct pgn2fen_game *g = &f->g;
+  struct stat st;
+  const char *move, *eol;
+  char line[LINESIZE], *p;
+  size_t n, end, used = 0, start;
+  ssize_t r;
+  int len, token;
+
+  if (stat(f->path, &st) < 0) /* It's being replaced, wait for the new one */
+    return;
+  if ((st.st_dev != f->dev || st.st_ino != f->inode) && !follow_open(f))
+    return;
+  if (fstat(f->fd, &st) < 0)
+    return;
+  if ((size_t) st.st_size < f->done) { /* Written again, from the start */
+    fprintf(stderr, "*** Warning: \"%s\" got shorter, reading it again from the beginning for moves not printed yet\n", f->path);
+    follow_open(f);
+  }
+  n = st.st_size - f->done;
+  if (n > f->cap) {
+    f->cap = n + (n >> 1);
+    f->buf = resize(f->buf, f->cap);
+  }
+  for (end = 0; end < n && (r = pread(f->fd, f->buf + end, n - end, f->done + end)) > 0; end += r);
+  /* Whatever comes after the last space may be half written, like "Nf" of "Nf3" */
+  while (end > 0 && !isspace((unsigned char) f->buf[end-1]))
+    end--;
+  pgn2fen_open_memory(f->buf, end, &in);
+  in.binary = 0; /* Even if the added bytes happen to look like one */
+  in.pos = 0;
+
+  while ((token = pgn2fen_read_token(&in, &move, &len, &start)) != PGN2FEN_TOKEN_EOF) {
+    if (PGN2FEN_TOKEN_TAG == token && (eol = memchr(in.data + in.pos, '\n', end - in.pos)) == NULL)
+      break; /* Not all of it is there yet */
+    if (g->over || (PGN2FEN_TOKEN_TAG == token && g->movetext)) { /* The next game */
+      pgn2fen_init_game(g);
+      f->game++;
+      f->broken = 0;
+    }
+    if (!g->started) {
+      g->started = 1;
+      g->offset = f->done + start;
+    }
+    if (PGN2FEN_TOKEN_TAG == token)
+      in.pos = eol + 1 - in.data;
+    else if (PGN2FEN_TOKEN_RESULT == token)
+      g->over = 1;
+    else if (PGN2FEN_TOKEN_MOVE == token && !f->broken) {
+      g->movetext = 1;
+      if (pgn2fen_play_san(&g->pos, move, len, &g->move) < 0) {
+        fprintf(stderr, "*** Warning: Game %d has a move that can't be played, \"%.*s\", skipping the rest of it\n", f->game, len, move);
+        f->broken = 1;
+      } else if (++g->ply > ((f->game <= f->ngames)?f->printed[f->game-1]:0)) {
+        if (f->game > f->ngames) {
+          f->printed = resize(f->printed, (f->game + 64) * sizeof(int));
+          memset(f->printed + f->ngames, 0, (f->game + 64 - f->ngames) * sizeof(int));
+          f->ngames = f->game + 64;
+        }
+        f->printed[f->game-1] = g->ply;
+        p = write_number(line, f->game);
+        *p++ = ' ';
+        p = write_number(p, g->offset);
+        *p++ = ' ';
+        p = write_number(p, g->ply);
+        *p++ = ' ';
+        p = write_position(p, opts, &g->pos);
+        fwrite(line, 1, p - line, foutput);
+      }
+    }
+    used = in.pos;
+  }
+  f->done += used;
+  fflush(foutput); /* Somebody is waiting for it */
+}
+
+/* Print the position after every move of every game of "path", and keep printing them as moves are added */
+/* to it, until we are stopped. We wait to hear from inotify that the file changed, or look every second */
+/* where there's no inotify. The directory is watched, not the file, so we notice when it's replaced */
+static void follow (FILE *foutput, const struct options *opts, const char *path) {
+
+  struct follow f;
+#ifdef __linux__
+  char events[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  const struct inotify_event *e;
+  char *dir, *name;
+  ssize_t len;
+  int ifd, changed;
+#endif
+
+  memset(&f, 0, sizeof(f));
+  f.path = path;
+  f.fd = -1;
+  if (!follow_open(&f)) {
+    printf("*** Error: The input file \"%s\" could not be opened\n", path);
+    exit(EXIT_FAILURE);
+  }
+#ifdef __linux__
+  if ((dir = strdup(path)) == NULL || (name = strdup(path)) == NULL)
+    out_of_memory();
+  if ((ifd = inotify_init1(IN_CLOEXEC)) < 0 ||
+      inotify_add_watch(ifd, dirname(dir), IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO) < 0) {
+    printf("*** Error: \"%s\" can't be watched for changes\n", path);
+    exit(EXIT_FAILURE);
+  }
+  name = basename(name);
+  for (;;) {
+    follow_read(&f, foutput, opts);
+    /* Wait until something happens to it. Changes to other files of the directory wake us up too */
+    for (changed = 0; !changed; )
+      if ((len = read(ifd, events, sizeof(events))) <= 0) {
+        printf("*** Error: \"%s\" can't be watched for changes\n", path);
+        exit(EXIT_FAILURE);
+      } else
+        for (e = (const struct inotify_event *) events; (const char *) e < events + len;
+             e = (const struct inotify_event *) ((const char *) e + sizeof(*e) + e->len))
+          changed |= (e->mask & IN_Q_OVERFLOW) || (e->len && !strcmp(e->name, name));
+  }
+#else
+  for (;;) {
+    follow_read(&f, foutput, opts);
+    sleep(1);
+  }
+#endif
+}
+
+/* Put "in" at the beginning of game "number" of "path". Its offset comes from the game index next to the */
+/* file, "path.gidx", which is built first if it isn't there or the file changed since it was built */
+static void seek_game (struct pgn2fen_input *in, const char *path, int number) {
+
+  struct pgn2fen_games idx;
+  char *indexpath;
+  int error;
+
+  if (!in->mapped || in->binary) {
+    printf("*** Error: --game needs a regular uncompressed PGN file, \"%s\" isn't one\n", path);
+    exit(EXIT_FAILURE);
+  }
+  if ((indexpath = malloc(strlen(path) + sizeof(".gidx"))) == NULL)
+    out_of_memory();
+  sprintf(indexpath, "%s.gidx", path);
+  if (pgn2fen_games_open(indexpath, path, &idx) < 0 &&
+      ((error = pgn2fen_games_build(path, indexpath)) < 0 || (error = pgn2fen_games_open(indexpath, path, &idx)) < 0)) {
+    printf("*** Error: The game index \"%s\" could not be built: %s\n", indexpath, pgn2fen_strerror(error));
+    exit(EXIT_FAILURE);
+  }
+  if ((size_t) number > idx.count) {
+    printf("*** Error: Game number %d does not exist\n", number);
+    exit(EXIT_FAILURE);
+  }
+  in->pos = idx.games[number-1].offset;
+  pgn2fen_games_close(&idx);
+  free(indexpath);
+}
+
+/* Print the games of "pgnpath" that reach the position "fen", looking them up in its index. Each line has */
+/* the offset of the game, the ply and the position as it was reached, clocks included. The index only has */
+/* keys, so the games are replayed up to that ply to make sure it's the same position and not a collision */
+static void query_index (FILE *foutput, const struct options *opts, const char *indexpath, const char *pgnpath, const char *fen) {
+
+  struct pgn2fen_index idx;
+  struct pgn2fen_position pos;
+  struct pgn2fen_input in;
+  struct pgn2fen_game g;
+  const struct pgn2fen_indexentry *e;
+  char line[LINESIZE], *p;
+  size_t n;
+  int error;
+
+  if ((error = pgn2fen_parse_fen(fen, &pos)) < 0) {
+    printf("*** Error: Invalid FEN \"%s\"\n", fen);
+    exit(EXIT_FAILURE);
+  }
+  if ((error = pgn2fen_index_open(indexpath, pgnpath, &idx)) < 0) {
+    printf("*** Error: The index \"%s\" could not be used: %s\n", indexpath, pgn2fen_strerror(error));
+    exit(EXIT_FAILURE);
+  }
+  if (pgn2fen_open(pgnpath, &in) < 0) {
+    printf("*** Error: The input file \"%s\" could not be opened\n", pgnpath);
+    exit(EXIT_FAILURE);
+  }
+  for (n = pgn2fen_index_find(&idx, pos.key, &e); n > 0; n--, e++) {
+    in.pos = PGN2FEN_INDEX_OFFSET(e);
+    pgn2fen_init_game(&g);
+    while (g.ply < PGN2FEN_INDEX_PLY(e) && pgn2fen_next_move(&in, &g, 1) > 0);
+    if (g.ply == PGN2FEN_INDEX_PLY(e) && pgn2fen_same_position(&g.pos, &pos)) {
+      p = write_number(line, g.offset);
+      *p++ = ' ';
+      p = write_number(p, g.ply);
+      *p++ = ' ';
+      p = write_position(p, opts, &g.pos);
+      fwrite(line, 1, p - line, foutput);
+    }
+  }
+  pgn2fen_close(&in);
+  pgn2fen_index_close(&idx);
+}
+
+/* Print the games that reach the position given as a FEN, without an index: the game number, its offset, */
+/* the ply and the position as it was reached, the first time it was. Each game is replayed only until */
+/* it reaches the position, or until it loses something the position has, and the rest is read past */
+static void search_games (struct pgn2fen_input *in, FILE *foutput, const struct options *opts, const char *fen) {
+
+  struct pgn2fen_target t;
+  struct pgn2fen_position pos;
+  struct pgn2fen_game g;
+  char line[LINESIZE], *p;
+  unsigned long long game = 0;
+  int found;
+
+  if (pgn2fen_parse_fen(fen, &pos) < 0) {
+    printf("*** Error: Invalid FEN \"%s\"\n", fen);
+    exit(EXIT_FAILURE);
+  }
+  pgn2fen_init_target(&t, &pos);
+  for (;;) {
+    pgn2fen_init_game(&g);
+    if ((found = pgn2fen_search_game(in, &g, &t)) < 0 || !g.started)
+      break;
+    game++;
+    if (found) {
+      p = write_number(line, game);
+      *p++ = ' ';
+      p = write_number(p, g.offset);
+      *p++ = ' ';
+      p = write_number(p, g.ply);
+      *p++ = ' ';
+      p = write_position(p, opts, &g.pos);
+      fwrite(line, 1, p - line, foutput);
+      pgn2fen_skip_game(in, &g);
+    }
+  }
+  if (in->error) {
+    printf("*** Error: %s\n", pgn2fen_strerror(in->error));
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* The positions move generators are checked against, and how many move sequences each has, from 1 ply deep on. */
+/* From the Chess Programming Wiki, 0 is a depth we don't know */
+static const struct {
+  const char *name, *fen;
+  uint64_t nodes[6];
+} perftpositions[] = {
+  { "initial", "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    { 20, 400, 8902, 197281, 4865609, 119060324 } },
+  { "kiwipete", "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    { 48, 2039, 97862, 4085603, 193690690, 8031647685ULL } },
+  { "position 3", "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    { 14, 191, 2812, 43238, 674624, 11030083 } },
+  { "position 4", "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+    { 6, 264, 9467, 422333, 15833292, 706045033 } },
+  { "position 5", "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+    { 44, 1486, 62379, 2103487, 89941194, 3048196529ULL } },
+  { "position 6", "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    { 46, 2079, 89890, 3894594, 164075551, 6923051137ULL } }
+};
+
+/* Write a move the way engines do, like "e7e8q" */
+static void print_move (FILE *foutput, pgn2fen_move move) {
+  fprintf(foutput, "%c%c%c%c", 'a' + PGN2FEN_MOVE_FROM(move) % 8, '1' + PGN2FEN_MOVE_FROM(move) / 8,
+          'a' + PGN2FEN_MOVE_TO(move) % 8, '1' + PGN2FEN_MOVE_TO(move) / 8);
+  if (PGN2FEN_MOVE_PROMOTION(move))
+    fputc(" nbrq"[PGN2FEN_MOVE_PROMOTION(move)], foutput);
+}
+
+/* Count the move sequences "depth" plies long from "fen", move by move. Without a FEN, from each of the */
+/* reference positions, checking the counts we know and how fast they went. Exits with an error if one is wrong */
+static void perft (int depth, const char *fen) {
+
+  pgn2fen_move moves[PGN2FEN_MAXMOVES];
+  struct pgn2fen_position pos, next;
+  uint64_t nodes, total = 0, expected;
+  double start, elapsed;
+  int failed = 0, n, i;
+
+  if (fen) {
+    if (pgn2fen_parse_fen(fen, &pos) < 0) {
+      printf("*** Error: Invalid FEN \"%s\"\n", fen);
+      exit(EXIT_FAILURE);
+    }
+    n = pgn2fen_legal_moves(&pos, moves);
+    for (i = 0; i < n; i++) {
+      next = pos;
+      pgn2fen_play_move(&next, moves[i]);
+      nodes = pgn2fen_perft(&next, depth - 1);
+      print_move(stdout, moves[i]);
+      printf(" %llu\n", (unsigned long long) nodes);
+      total += nodes;
+    }
+    printf("%llu\n", (unsigned long long) total);
+    return;
+  }
+  for (i = 0; i < (int) (sizeof(perftpositions) / sizeof(perftpositions[0])); i++) {
+    pgn2fen_parse_fen(perftpositions[i].fen, &pos);
+    start = clocks(NULL);
+    nodes = pgn2fen_perft(&pos, depth);
+    elapsed = clocks(NULL) - start;
+    expected = (depth <= 6)?perftpositions[i].nodes[depth-1]:0;
+    printf("%-12s depth %d %14llu nodes %9.3f s %8.1f Mnodes/s  %s\n", perftpositions[i].name, depth, (unsigned long long) nodes,
+           elapsed, nodes / elapsed / 1e6, (!expected)?"?":(nodes == expected)?"OK":"WRONG");
+    if (expected && nodes != expected)
+      failed = 1;
+  }
+  if (failed) {
+    printf("*** Error: The move generator is wrong\n");
+    exit(EXIT_FAILURE);
+  }
+}
 
 int main (int argc, char **argv) {
 
   int move /* move number argument */;
   char side = 'w'; /* Default side is white */
-  FILE   *finput, *foutput = NULL;
+  FILE   *foutput = NULL;
+  struct pgn2fen_input in; /* The input file, all of it */
+  char *args[NARGS + NARGSOPT + 1]; /* Program name and arguments, once the options are taken out */
+  int nargs = 0, database = 0, allplies = 0, variations = 0, until = 0, threads = 1, batchmode = 0, keys = KEYS_NONE, game = 0, stats = 0, depth = 0, unique = 0, following = 0, error, i;
+  long memory = UNIQUEMEMORY;
+  char *p, *buildindex = NULL, *queryindex = NULL, *convert = NULL, *search = NULL, *where = NULL;
+  struct pgn2fen_filter filter;
+  double started = clocks(NULL);
+
+  /* Take the options out of the way */
+  args[nargs++] = argv[0];
+  for (i = 1; i < argc; i++)
+    if (!strcmp(argv[i], "-d") || !strcmp(argv[i], "--database"))
+      database = 1;
+    else if (!strcmp(argv[i], "-b") || !strcmp(argv[i], "--batch"))
+      batchmode = 1;
+    else if (!strcmp(argv[i], "-a") || !strcmp(argv[i], "--all-plies"))
+      allplies = 1;
+    else if (!strcmp(argv[i], "-f") || !strcmp(argv[i], "--follow"))
+      following = 1;
+    else if (!strcmp(argv[i], "-U") || !strcmp(argv[i], "--unique"))
+      unique = 1;
+    else if (!strcmp(argv[i], "-V") || !strcmp(argv[i], "--variations"))
+      variations = 1;
+    else if (!strcmp(argv[i], "-k") || !strcmp(argv[i], "--key"))
+      keys = KEYS_TOO;
+    else if (!strcmp(argv[i], "-K") || !strcmp(argv[i], "--key-only"))
+      keys = KEYS_ONLY;
+    else if (!strcmp(argv[i], "--stats") || !strcmp(argv[i], "--stats=json"))
+      stats = (!strcmp(argv[i], "--stats"))?STATS_TEXT:STATS_JSON;
+    else if ((!strcmp(argv[i], "-u") || !strcmp(argv[i], "--until")) && i+1 < argc) {
+      /* A move number, optionally followed by the side, like "40b" */
+      if ((until = 2*strtol(argv[++i], &p, 10) - 1) <= 0 || (*p && strcmp(p, "w") && strcmp(p, "b"))) {
+        printf("*** Error: Invalid move \"%s\"\n", argv[i]);
+        exit(EXIT_FAILURE);
+      }
+      if ('b' == *p)
+        until++;
+    } else if ((!strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs")) && i+1 < argc) {
+      if ((threads = atoi(argv[++i])) <= 0) {
+        printf("*** Error: Invalid number of jobs \"%s\"\n", argv[i]);
+        exit(EXIT_FAILURE);
+      }
+    } else if ((!strcmp(argv[i], "-m") || !strcmp(argv[i], "--memory")) && i+1 < argc) {
+      if ((memory = atol(argv[++i])) <= 0) {
+        printf("*** Error: Invalid amount of memory \"%s\"\n", argv[i]);
+        exit(EXIT_FAILURE);
+      }
+    } else if ((!strcmp(argv[i], "-g") || !strcmp(argv[i], "--game")) && i+1 < argc) {
+      if ((game = atoi(argv[++i])) <= 0) {
+        printf("*** Error: Invalid game number \"%s\"\n", argv[i]);
+        exit(EXIT_FAILURE);
+      }
+    } else if ((!strcmp(argv[i], "-i") || !strcmp(argv[i], "--index")) && i+1 < argc)
+      buildindex = argv[++i];
+    else if ((!strcmp(argv[i], "-q") || !strcmp(argv[i], "--query")) && i+1 < argc)
+      queryindex = argv[++i];
+    else if (!strcmp(argv[i], "--where") && i+1 < argc) {
+      if (pgn2fen_parse_filter(where = argv[++i], &filter) < 0) {
+        printf("*** Error: Invalid filter \"%s\"\n", argv[i]);
+        exit(EXIT_FAILURE);
+      }
+    } else if ((!strcmp(argv[i], "-s") || !strcmp(argv[i], "--search")) && i+1 < argc)
+      search = argv[++i];
+    else if ((!strcmp(argv[i], "-c") || !strcmp(argv[i], "--convert")) && i+1 < argc)
+      convert = argv[++i];
+    else if ((!strcmp(argv[i], "-p") || !strcmp(argv[i], "--perft")) && i+1 < argc) {
+      if ((depth = atoi(argv[++i])) <= 0) {
+        printf("*** Error: Invalid depth \"%s\"\n", argv[i]);
+        exit(EXIT_FAILURE);
+      }
+    }
+    else if (nargs <= NARGS + NARGSOPT)
+      args[nargs++] = argv[i];
+    else
+      nargs = NARGS + NARGSOPT + 2; /* Too many, it will show the usage */
+  argc = nargs;
+  argv = args;
+
+  if (stats) {
+    struct pgn2fen_stats probe = { 0 };
+    if (!pgn2fen_stats(&probe)) {
+      printf("*** Error: --stats needs pgn2fen built with make STATS=1\n");
+      exit(EXIT_FAILURE);
+    } else if (batchmode || buildindex || queryindex || convert || depth || unique || search || following) {
+      printf("*** Error: --stats can't be used with -b, -i, -q, -c, -p, -U, -s or -f\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (where && !database && !unique && !search) {
+    printf("*** Error: --where only works with -d, -s or -U\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (batchmode) { /* The queries come from stdin, the only argument is the output file */
+    if (argc-1 > 1) {
+      printf("*** Error: With -b the queries are read from stdin, only the output file can be given\n");
+      exit(EXIT_FAILURE);
+    } else if (1 == argc-1 && (foutput = fopen(argv[1], "w")) == NULL) {
+      printf("*** Error: The output file \"%s\" could not be opened\n", argv[1]);
+      exit(EXIT_FAILURE);
+    }
+    batch((foutput)?foutput:stdout);
+    exit(EXIT_SUCCESS);
+  }
+
+  if (buildindex) { /* Only the input file */
+    if (argc-1 != 1) {
+      printf("*** Error: With -i only the input file can be given\n");
+      exit(EXIT_FAILURE);
+    } else if ((error = pgn2fen_index_build(argv[1], buildindex)) < 0) {
+      printf("*** Error: The index \"%s\" could not be built: %s\n", buildindex, pgn2fen_strerror(error));
+      exit(EXIT_FAILURE);
+    }
+    exit(EXIT_SUCCESS);
+  }
+
+  if (convert) { /* Only the input file */
+    if (argc-1 != 1) {
+      printf("*** Error: With -c only the input file can be given\n");
+      exit(EXIT_FAILURE);
+    } else if ((error = pgn2fen_binary_build(argv[1], convert)) < 0) {
+      printf("*** Error: The binary database \"%s\" could not be written: %s\n", convert, pgn2fen_strerror(error));
+      exit(EXIT_FAILURE);
+    }
+    exit(EXIT_SUCCESS);
+  }
+
+  if (depth) { /* Maybe a FEN */
+    if (argc-1 > 1) {
+      printf("*** Error: With -p only a FEN (quoted) can be given\n");
+      exit(EXIT_FAILURE);
+    }
+    perft(depth, (1 == argc-1)?argv[1]:NULL);
+    exit(EXIT_SUCCESS);
+  }
+
+  if (following) { /* The input file and maybe the output file */
+    struct options opts = { 0 };
+    opts.keys = keys;
+    if (argc-1 < 1 || argc-1 > 2) {
+      printf("*** Error: With -f give the input file and optionally the output file\n");
+      exit(EXIT_FAILURE);
+    } else if (!strcmp(argv[1], "-")) {
+      printf("*** Error: With -f the input has to be a file\n");
+      exit(EXIT_FAILURE);
+    } else if (2 == argc-1 && (foutput = fopen(argv[2], "w")) == NULL) {
+      printf("*** Error: The output file \"%s\" could not be opened\n", argv[2]);
+      exit(EXIT_FAILURE);
+    }
+    follow((foutput)?foutput:stdout, &opts, argv[1]);
+    exit(EXIT_SUCCESS);
+  }
+
+  if (unique || search) { /* The input file and maybe the output file */
+    struct options opts = { 0 };
+    opts.keys = keys;
+    opts.threads = threads;
+    if (argc-1 < 1 || argc-1 > 2) {
+      printf("*** Error: With %s give the input file and optionally the output file\n", (unique)?"-U":"-s");
+      exit(EXIT_FAILURE);
+    } else if ((error = pgn2fen_open(argv[1], &in)) < 0) {
+      printf("*** Error: The input file \"%s\" could not be opened: %s\n", argv[1], pgn2fen_strerror(error));
+      exit(EXIT_FAILURE);
+    } else if (2 == argc-1 && (foutput = fopen(argv[2], "w")) == NULL) {
+      printf("*** Error: The output file \"%s\" could not be opened\n", argv[2]);
+      exit(EXIT_FAILURE);
+    }
+    if (where && in.binary) {
+      printf("*** Error: Binary databases have no tags for --where\n");
+      exit(EXIT_FAILURE);
+    }
+    in.filter = (where)?&filter:NULL;
+    if (!foutput)
+      foutput = stdout;
+    setvbuf(foutput, NULL, _IOFBF, OUTPUTBUFFER);
+    if (unique)
+      unique_positions(&in, foutput, &opts, (size_t) memory << 20);
+    else
+      search_games(&in, foutput, &opts, search);
+    pgn2fen_close(&in);
+    exit(EXIT_SUCCESS);
+  }
+
+  if (queryindex) { /* The input file, the FEN and maybe the output file */
+    struct options opts = { 0 };
+    opts.keys = keys;
+    if (argc-1 < 2 || argc-1 > 3) {
+      printf("*** Error: With -q give the input file, the FEN (quoted) and optionally the output file\n");
+      exit(EXIT_FAILURE);
+    } else if (3 == argc-1 && (foutput = fopen(argv[3], "w")) == NULL) {
+      printf("*** Error: The output file \"%s\" could not be opened\n", argv[3]);
+      exit(EXIT_FAILURE);
+    }
+    query_index((foutput)?foutput:stdout, &opts, queryindex, argv[1], argv[2]);
+    exit(EXIT_SUCCESS);
+  }
 
   /* Check the program arguments */
   if ((argc-1 >= NARGS) && (argc-1 <= NARGS + NARGSOPT)) {
-    if ((finput = fopen(argv[1], "r")) == NULL) {
-      printf("*** Error: The input file \"%s\" could not be opened\n", argv[1]);
+    if ((error = pgn2fen_open(argv[1], &in)) < 0) {
+      if (PGN2FEN_EDECOMPRESS == error)
+        printf("*** Error: The input file \"%s\" is compressed in a way this build can't read\n", argv[1]);
+      else
+        printf("*** Error: The input file \"%s\" could not be opened\n", argv[1]);
       exit(EXIT_FAILURE);        
     } else if ((move = atoi(argv[2])) <= 0) {
-      fclose(finput);
+      pgn2fen_close(&in);
       printf("*** Error: Invalid move number \"%s\"\n", argv[2]);
       exit(EXIT_FAILURE);
     } else if (argc-1 > NARGS) { /* Optional arguments */
@@ -45,7 +1405,7 @@ int main (int argc, char **argv) {
         if (strlen(argv[3]) == 1) {
           side = tolower(argv[3][0]);
           if (side != 'w' && side != 'b') {
-            fclose(finput);
+            pgn2fen_close(&in);
             printf("*** Error: Invalid side \"%s\"\n", argv[3]);
             exit(EXIT_FAILURE);
           }
@@ -57,12 +1417,12 @@ int main (int argc, char **argv) {
         if (strlen(argv[3]) == 1) {
           side = tolower(argv[3][0]);
           if (side != 'w' && side != 'b') {
-            fclose(finput);
+            pgn2fen_close(&in);
             printf("*** Error: Invalid side \"%s\"\n", argv[3]);
             exit(EXIT_FAILURE);
           }
         } else {
-            fclose(finput);
+            pgn2fen_close(&in);
             printf("*** Error: Invalid side \"%s\"\n", argv[3]);
             exit(EXIT_FAILURE);
         }
@@ -74,8 +1434,35 @@ int main (int argc, char **argv) {
       }
     }
   } else {
-    printf("Usage: %s input_game.pgn move [w/b] [output_position.fen]\n", argv[0]);
-    printf("  input_game.pgn       - A chess game in PGN format.\n");
+    printf("Usage: %s [-d [-j jobs]] [-a [-u move[w/b]]] [-V] [-k|-K] [-g game] [--where filter] [--stats[=json]] input_game.pgn move [w/b] [output_position.fen]\n", argv[0]);
+    printf("       %s -b [output_position.fen]\n", argv[0]);
+    printf("       %s -i index input_game.pgn\n", argv[0]);
+    printf("       %s -q index input_game.pgn fen [output_position.fen]\n", argv[0]);
+    printf("       %s -c binary input_game.pgn\n", argv[0]);
+    printf("       %s -p depth [fen]\n", argv[0]);
+    printf("       %s -s fen [-k|-K] [--where filter] input_game.pgn [output.txt]\n", argv[0]);
+    printf("       %s -U [-j jobs] [-m megabytes] [-k|-K] [--where filter] input_game.pgn [output.txt]\n", argv[0]);
+    printf("       %s -f [-k|-K] input_game.pgn [output.txt]\n", argv[0]);
+    printf("  -d, --database       - OPTIONAL. Process every game in the file. Each line is prefixed by the game number and its byte offset.\n");
+    printf("  -j, --jobs           - OPTIONAL. With -d or -U, replay the games on this many threads. The output comes out in the same order.\n");
+    printf("  -g, --game           - OPTIONAL. Read this game of the file instead of the first one. Its offset is kept in input_game.pgn.gidx.\n");
+    printf("  -b, --batch          - Answer many queries in one go. They are read from stdin, one per line: input_game.pgn game move [w/b]\n");
+    printf("  -i, --index          - Build an index of every position of every game in the file, to be used with -q.\n");
+    printf("  -q, --query          - Print the games that reach the position given as a FEN, using the index built with -i.\n");
+    printf("  -c, --convert        - Replay every game in the file once and save the moves in a binary database, which can be given as input_game.pgn.\n");
+    printf("  -p, --perft          - Count the move sequences this many plies deep from the FEN, move by move, or check the move generator on known positions.\n");
+    printf("  -s, --search         - Print the games that reach the position given as a FEN (quoted), replaying them without an index.\n");
+    printf("  -U, --unique         - Print every distinct position reached in the file once, with how many times it was reached.\n");
+    printf("  -m, --memory         - OPTIONAL. With -U, megabytes of memory for the positions, beyond which they go to temporary files. Defaults to %d.\n", UNIQUEMEMORY);
+    printf("  -f, --follow         - Print the position after every move of every game, and keep printing new ones as the file grows.\n");
+    printf("  -a, --all-plies      - OPTIONAL. Print the position after every half-move, starting at move, each one preceded by its ply number.\n");
+    printf("  -u, --until          - OPTIONAL. With -a, stop after this move, e.g. 40b. Defaults to the end of the game.\n");
+    printf("  -V, --variations     - OPTIONAL. Follow the variations too. Each line says which one it's from, like 7.1,9.2, 0 being the main line.\n");
+    printf("  -k, --key            - OPTIONAL. Print the Zobrist key of the position, in hexadecimal, before the FEN.\n");
+    printf("  -K, --key-only       - OPTIONAL. Print the Zobrist key of the position instead of the FEN.\n");
+    printf("  --where              - OPTIONAL. With -d, -s or -U, only the games whose tags pass the filter, like 'WhiteElo>=2500 && ECO=B9*'.\n");
+    printf("  --stats[=json]       - OPTIONAL. At the end, report to stderr where the time went and what was read. Needs make STATS=1.\n");
+    printf("  input_game.pgn       - A chess game in PGN format, it may be compressed with gzip. Use - to read it from stdin.\n");
     printf("  move                 - A move number.\n");
     printf("  w/b                  - OPTIONAL. Position reached after (w)hite or (b)lack move. Defaults to w.\n");
     printf("  output_position.fen  - OPTIONAL. Output file. If not specified the output will be written to stdout.\n");
@@ -96,758 +1483,70 @@ int main (int argc, char **argv) {
   
   if (foutput == NULL) /* They didn't specify an output file so write to stdout */
     foutput = stdout;
+  /* With -d or -a there can be lots of lines, they are gathered and written out a big piece at a time */
+  setvbuf(foutput, NULL, _IOFBF, OUTPUTBUFFER);
   
-  /* List to hold the moves */
-  struct tlist {
-    char move[8]; /* Max length if we don't count checks/mates is 6, e.g. exd8=Q, Nd7xe5 */
-    struct tlist *next;
-  };
-
-  struct tlist *list, *x, *y; /* List head pointed by "list", "x" & "y" are auxiliary */
-  list = malloc(sizeof(struct tlist)); /* Create an empty list member to make life easier */
-  list->next = NULL;
-  x = list;
-
-  int i, j; /* Why didn't we have one of these before?? */
-  char c, d;  /* Buffers to hold chars */
-  int breakout = 0, breakout2 = 0; /* flags to breakout of while loops from within switch statements */
-  int ply = 1; /* "ply" is the half-move number in the pgn file. "move" is the argument. */
-  int blackmove = 0; /* If we want the position after black moved, we have to go one more loop iteration */
-  if ('b' == side)
-    blackmove = 1;
-  /* Load the moves into the linked list */
-  while (!feof(finput) && ((ply+blackmove)/2 < move + blackmove)) {
-    /* Add a new item to the list */
-    y = malloc(sizeof(struct tlist));
-    y->next = NULL;
-
-    i = 0; /* Set's the position of the move array (of chars) to 0 */
-    breakout = 0;
-    while (!breakout && (c = fgetc(finput)) != EOF) {
-      switch (c) {
-        case '[': /* It's a tag, read past it */
-          while (fgetc(finput) != '\n');
-          break;
-        case '(': /* Variation, read past it, after the space */
-          while (fgetc(finput) != ')');
-          fgetc(finput); /* Discard space */
-          break;
-        case '{': /* Commentary, read past it, after the space */
-          while (fgetc(finput) != '}');
-          fgetc(finput); /* Discard space */
-          break;
-        case '1':  case '2':  case '3':  case '4':  case '5':  case '6':  case '7':  case '8': case '9':
-          breakout2 = 0;
-          /* Distinguish between move numbers and things like R2xf4 */
-          d = c; /* Keep the old number in hand */
-          while (!breakout2 && (c = fgetc(finput)) != EOF) { /* If it's a number keep eating chars */
-            switch (c) {
-              case '.': /* It's the beginning of a move, so eat the space */
-                fgetc(finput);
-                breakout2 = 1;
-                break;
-              /* It's not a number, so store the first number and the following char, and break out the loop */
-              case 'a':  case 'b':  case 'c':  case 'd':  case 'e':  case 'f':  case 'g':  case 'h':
-              case 'R':  case 'N':  case 'B': case 'Q': case 'K':
-              case 'x': case 'O': case '-':  case '=':
-                y->move[i++] = d;
-                y->move[i++] = c;
-                breakout2 = 1;
-                break;
-              case ' ':  case '\n': /* It's the ending of a move with number like e4 */
-                y->move[i++] = d;
-                breakout = breakout2 = 1;
-                break;
-            }
-          }
-          if (feof(finput)) { /* We reached EOF while saving the last move! */
-            y->move[i++] = d; 
-            breakout = 1; 
-            clearerr(finput); /* Clear the EOF flag */
-          }
-          break;
-        case 'a':  case 'b':  case 'c':  case 'd':  case 'e':  case 'f':  case 'g':  case 'h':
-        case 'R':  case 'N':  case 'B': case 'Q': case 'K':
-        case 'x': case 'O': case '-':  case '=':
-          y->move[i++] = c;
-          break;
-        case ' ': case '\n': /* Finish reading the move. Break out of the loop */
-          if (feof(finput)) /* We reached EOF while saving the last move! */
-            clearerr(finput); /* Clear the EOF flag */
-          if (strlen(y->move) > 0) /* Don't save empty lines */
-            breakout = 1;
-          break;
-      }
-    }
+  struct options opts;
+  int plies = 2*move - ((side == 'w')?1:0); /* How many half-moves we have to play */
+  size_t offset; /* Where the game begins */
+  int illegal;
 
-    x->next = y;
-    x = y;
-    ply++;
+  opts.first = opts.last = plies;
+  opts.database = database;
+  opts.allplies = allplies;
+  opts.variations = variations;
+  in.variations = variations;
+  if (where && in.binary) {
+    printf("*** Error: Binary databases have no tags for --where\n");
+    exit(EXIT_FAILURE);
   }
+  in.filter = (where)?&filter:NULL;
+  opts.keys = keys;
+  opts.threads = threads;
+  opts.stats = stats;
+  if (allplies) /* From the requested move up to "until" or the end of the game */
+    opts.last = (until)?until:INT_MAX;
 
-  if (feof(finput)) {
-    printf("*** Error: Move number %d by %s does not exist\n", move, (side == 'w')?"white":"black");
+  if (opts.last < opts.first) {
+    printf("*** Error: Nothing to print, the last move comes before the first one\n");
     exit(EXIT_FAILURE);
   }
 
-  /* Now we have the list of moves loaded into "list" */
-
-  /* We need to set up a board to record the game as it progress */
-  /* This is the structure we'll use to display the first field of the FEN output */
-  char board[RANKS][FILES] = {
-    /* 8 */ {'r', 'n', 'b', 'q', 'k', 'b', 'n', 'r'},
-
-    /* 7 */ {'p', 'p', 'p', 'p', 'p', 'p', 'p', 'p'},
-
-    /* 6 */ {'1', '1', '1', '1', '1', '1', '1', '1'},
-
-    /* 5 */ {'1', '1', '1', '1', '1', '1', '1', '1'},
-
-    /* 4 */ {'1', '1', '1', '1', '1', '1', '1', '1'},
-
-    /* 3 */ {'1', '1', '1', '1', '1', '1', '1', '1'},
-
-    /* 2 */ {'P', 'P', 'P', 'P', 'P', 'P', 'P', 'P'},
-
-    /* 1 */ {'R', 'N', 'B', 'Q', 'K', 'B', 'N', 'R'}
-
-    /*        a    b    c    d    e    f    g    h        */  
-  };
-
-  char castling = CASTLEK | CASTLEQ | CASTLEk | CASTLEq; /* Third field of the FEN: KQkq, each letter represents a bit */
-  int turn = WHITE;
-  int enpassant = 0;
-  char target; /* Enpassant traget square. If it's a white pawn push the rank will always be 3, and 6 for black */
-  char rook[2]; /* Rook origin for castling tests */
-  int found = 0;
-  ply = 0; /* Re-using variables, yay! This time it will be the ply clock, the fifth field of the FEN */
-
-  x = list->next; /* Skip the empty item */
-  while (x) {
-    ply++; /* Advance halfmove clock. It could be reset later */
-    switch (x->move[0]) {
-      case 'a':  case 'b':  case 'c':  case 'd':  case 'e':  case 'f':  case 'g':  case 'h': /* Pawn move */
-        if (strstr(x->move,"=")) { /* Pawn promotion */
-          for (i = 0; x->move[i] != '='; i++); /* i is now the position of "=" */
-          if (turn) { /* White */
-            /* Set origin square */
-            board[1][x->move[0] - 'a'] = '1';
-            /* Set destination square */
-            board[0][x->move[i-2] - 'a'] = x->move[i+1];
-            /* If the promotion occurs with a rook capture on the corner, the other color lose castling on that side */
-            if ('a' == x->move[i-2])
-              castling &= ~CASTLEq; /* Black Queenside */
-            else if ('h' == x->move[i-2])
-              castling &= ~CASTLEk; /* Black Kingside */
-          } else { /* Black */
-            /* Set origin square */
-            board[RANKS-2][x->move[0] - 'a'] = '1';
-            /* Set destination square */
-            board[RANKS-1][x->move[i-2] - 'a'] = tolower(x->move[i+1]); /* Promotions are uppercase */
-            if ('a' == x->move[i-2]) /* Check for rook capture */
-              castling &= ~CASTLEQ; /* White Queenside */
-            else if ('h' == x->move[i-2])
-              castling &= ~CASTLEK; /* White Kingside */
-          }
-          enpassant = 0;
-        } else if (strlen(x->move) > 2) { /* Move with capture */
-          /* Set origin square */
-          if (turn)
-            board[RANKS - (x->move[3] - '0') + 1][x->move[0] - 'a'] = '1';
-          else
-            board[RANKS - (x->move[3] - '0') - 1][x->move[0] - 'a'] = '1';
-          if (enpassant) { /* Clear the passed pawn */
-            /* We need the origin, so we add (black) or subtract (white) 1 from the destination */
-            /* In this case we don't need to translate the position to the matrix rank */
-            if (turn && (x->move[3] - '0') - 1 == 5) /* If the capturing pawn is white it must be on rank 5 */
-              board[RANKS - (x->move[3] - '0') + 1][x->move[2] - 'a'] = '1';
-            else if ((x->move[3] - '0') + 1 == 4) /* If the capturing pawn is black it must be on rank 4 */
-              board[RANKS - (x->move[3] - '0') - 1][x->move[2] - 'a'] = '1';
-          }
-          enpassant = 0;
-          /* Set destination square */
-          /* Parenthesis are important, otherwise because RANKS is an int, the chars will get promoted and we'll get a wrong result */
-          board[RANKS - (x->move[3] - '0')][x->move[2] - 'a'] = (turn)?'P':'p';
-        } else {
-          enpassant = 0;
-          /* Set origin square */
-          if (turn && '4' == x->move[1] && board[6][x->move[0] - 'a'] == 'P') { /* The pawn could've came from white's first move */
-            board[6][x->move[0] - 'a'] = '1';
-            enpassant = 1;
-            target = x->move[0];
-          }  else if (!turn && '5' == x->move[1] && board[1][x->move[0] - 'a'] == 'p') { /* The pawn could've came from black's first move */
-            board[1][x->move[0] - 'a'] = '1';
-            enpassant = 1;
-            target = x->move[0];
-          } else if (turn) /* White pawn push */
-            board[RANKS - (x->move[1] - '0') + 1][x->move[0] - 'a'] = '1';
-          else /* Black pawn push */
-            board[RANKS - (x->move[1] - '0') - 1][x->move[0] - 'a'] = '1';
-          /* Set destination square */
-          board[RANKS - (x->move[1] - '0')][x->move[0] - 'a'] = (turn)?'P':'p';
-        }
-        ply = 0; /* Pawn move or capture resets the halfmove clock */
-        break;
-      case 'R': /* Rook move */
-        c = (turn)?'R':'r'; /* Set piece. Altough it would be clearer to define a new var "piece", I prefer to be confusing and reuse vars */
-        /* Remove "x" if any */
-        for (i = 0; x->move[i] != '\0'; i++)
-          if (x->move[i] == 'x') {
-            ply = 0; /* Capture resets the halfmove clock */
-            for (j = i; x->move[j] != '\0'; j++)
-              x->move[j] = x->move[j+1];
-            break;
-          }
-        if (4 == strlen(x->move)) { /* Disambiguate move */
-          /* Set origin square */
-          if (x->move[1] > '8') { /* It's a letter, i.e. a file, then simply the origin file is given to us */
-            if (x->move[1] == x->move[2]) { /* Same file move */
-              for (found = 0, i = RANKS - (x->move[3] - '0') + 1; i < RANKS; i++) /* Look down on the file */
-                if (board[i][x->move[1] - 'a'] == c) {
-                  board[i][x->move[1] - 'a'] = '1';
-                  rook[0] = x->move[1]; 
-                  rook[1] = '0' + (RANKS - i); 
-                  found = 1;
-                  break;
-                } else if (board[i][x->move[1] - 'a'] != '1') /* We hit a piece */
-                  break;
-              for (i = RANKS - (x->move[3] - '0') - 1; !found && i >= 0; i--) /* Look up on the file */
-                if (board[i][x->move[1] - 'a'] == c) {
-                  board[i][x->move[1] - 'a'] = '1';
-                  rook[0] = x->move[1]; 
-                  rook[1] = '0' + (RANKS - i); 
-                  break;
-                } else if (board[i][x->move[1] - 'a'] != '1') /* We hit a piece */
-                  break;
-            } else { /* Same rank move */
-              board[RANKS - (x->move[3] - '0')][x->move[1] - 'a'] = '1';
-              rook[0] = x->move[1];
-              rook[1] = x->move[3];
-            }
-          }  else { /* It's a number, i.e. the origin rank is given to us */
-            if (x->move[1] == x->move[3]) { /* Same rank move */
-              for (found = 0, i = (x->move[2] - 'a') + 1; i < FILES; i++) /* Look to the right on the rank */
-                if (board[RANKS - (x->move[1] - '0')][i] == c) {
-                  board[RANKS - (x->move[1] - '0')][i] = '1';
-                  rook[0] = 'a' + i; 
-                  rook[1] = x->move[1]; 
-                  found = 1;
-                  break;
-                } else if (board[RANKS - (x->move[1] - '0')][i] != '1') /* We hit a piece */
-                  break;
-              for (i = (x->move[2] - 'a') - 1; !found && i >= 0; i--) /* Look to the left on the rank */
-                if (board[RANKS - (x->move[1] - '0')][i] == c) {
-                  board[RANKS - (x->move[1] - '0')][i] = '1';
-                  rook[0] = 'a' + i; 
-                  rook[1] = x->move[1]; 
-                  break;
-                } else if (board[RANKS - (x->move[1] - '0')][i] != '1') /* We hit a piece */
-                  break;
-            } else { /* Same file move */
-              board[RANKS - (x->move[1] - '0')][x->move[2] - 'a'] = '1';
-              rook[0] = x->move[2];
-              rook[1] = x->move[1];
-            }
-          }
-          /* To set the destination square cut the extra letter */
-          x->move[1] = x->move[2]; x->move[2] = x->move[3]; x->move[3] = '\0';
-        } else { /* Unambigous move */
-          /* Set origin square */
-          for (found = 0, i = RANKS - (x->move[2] - '0') + 1; i < RANKS; i++) /* Look down on the file */
-            if (board[i][x->move[1] - 'a'] == c) {
-              board[i][x->move[1] - 'a'] = '1';
-              rook[0] = x->move[1]; 
-              rook[1] = '0' + (RANKS - i); 
-              found = 1;
-              break;
-            } else if (board[i][x->move[1] - 'a'] != '1') /* We hit a piece */
-              break;
-          for (i = RANKS - (x->move[2] - '0') - 1; !found && i >= 0; i--) /* Look up on the file */
-            if (board[i][x->move[1] - 'a'] == c) {
-              board[i][x->move[1] - 'a'] = '1';
-              rook[0] = x->move[1]; 
-              rook[1] = '0' + (RANKS - i); 
-              found = 1;
-              break;
-            } else if (board[i][x->move[1] - 'a'] != '1') /* We hit a piece */
-              break;
-          for (i = (x->move[1] - 'a') + 1; !found && i < FILES; i++) /* Look to the right on the rank */
-            if (board[RANKS - (x->move[2] - '0')][i] == c) {
-              board[RANKS - (x->move[2] - '0')][i] = '1';
-              rook[0] = 'a' + i; 
-              rook[1] = x->move[2]; 
-              found = 1;
-              break;
-            } else if (board[RANKS - (x->move[2] - '0')][i] != '1') /* We hit a piece */
-              break;
-          for (i = (x->move[1] - 'a') - 1; !found && i >= 0; i--) /* Look to the left on the rank */
-            if (board[RANKS - (x->move[2] - '0')][i] == c) {
-              board[RANKS - (x->move[2] - '0')][i] = '1';
-              rook[0] = 'a' + i; 
-              rook[1] = x->move[2]; 
-              break;
-            } else if (board[RANKS - (x->move[2] - '0')][i] != '1') /* We hit a piece */
-              break;
-        }
-        /* Set destination square */
-        board[RANKS - (x->move[2] - '0')][x->move[1] - 'a'] = c;
-        /* Moving a rook cancels castling on that side */
-        if       (strcmp(rook,"h1") == 0) /* White Kingside */
-            castling &= ~CASTLEK;
-        else if (strcmp(rook,"h8") == 0) /* Black Kingside */
-            castling &= ~CASTLEk;
-        else if (strcmp(rook,"a1") == 0) /* White Queenside */
-            castling &= ~CASTLEQ;
-        else if (strcmp(rook,"a8") == 0) /* Black Queenside */
-            castling &= ~CASTLEq;
-        enpassant = 0; /* Piece move cancels enpassant opportunity */
-        break;
-      case 'N': /* Knight move */
-        c = (turn)?'N':'n';
-        /* Remove "x" if any */
-        for (i = 0; x->move[i] != '\0'; i++)
-          if (x->move[i] == 'x') {
-            ply = 0; /* Capture resets the halfmove clock */
-            for (j = i; x->move[j] != '\0'; j++)
-              x->move[j] = x->move[j+1];
-            break;
-          }
-        if (strlen(x->move) == 3) {
-          /* Set origin square */
-          found = 0;
-          if (x->move[2] > '1') { /* Below, level -1 */
-            found = 1;
-            if (x->move[1] > 'b' && board[RANKS - (x->move[2] - '0') + 1][(x->move[1] - 'a') - 2] == c)
-              board[RANKS - (x->move[2] - '0') + 1][(x->move[1] - 'a') - 2] = '1';
-            else if (x->move[1] < 'g' && board[RANKS - (x->move[2] - '0') + 1][(x->move[1] - 'a') + 2] == c)
-              board[RANKS - (x->move[2] - '0') + 1][(x->move[1] - 'a') + 2] = '1';
-            else if (x->move[2] > '2') { /* Below, level -2 */
-              if (x->move[1] > 'a' && board[RANKS - (x->move[2] - '0') + 2][(x->move[1] - 'a') - 1] == c)
-                board[RANKS - (x->move[2] - '0') + 2][(x->move[1] - 'a') - 1] = '1';
-              else if (x->move[1] < 'h' && board[RANKS - (x->move[2] - '0') + 2][(x->move[1] - 'a') + 1] == c)
-                board[RANKS - (x->move[2] - '0') + 2][(x->move[1] - 'a') + 1] = '1';
-              else
-                found = 0;
-            }  else
-              found = 0;
-          } 
-          if (!found && x->move[2] < '8') { /* Above, level +1 */
-            if (x->move[1] > 'b' && board[RANKS - (x->move[2] - '0') - 1][(x->move[1] - 'a') - 2] == c)
-              board[RANKS - (x->move[2] - '0') - 1][(x->move[1] - 'a') - 2] = '1';
-            else if (x->move[1] < 'g' && board[RANKS - (x->move[2] - '0') - 1][(x->move[1] - 'a') + 2] == c)
-              board[RANKS - (x->move[2] - '0') - 1][(x->move[1] - 'a') + 2] = '1';
-            else if (x->move[2] < '7') { /* Above, level +2 */
-              if (x->move[1] > 'a' && board[RANKS - (x->move[2] - '0') - 2][(x->move[1] - 'a') - 1] == c)
-                board[RANKS - (x->move[2] - '0') - 2][(x->move[1] - 'a') - 1] = '1';
-              else if (x->move[1] < 'h' && board[RANKS - (x->move[2] - '0') - 2][(x->move[1] - 'a') + 1] == c)
-                board[RANKS - (x->move[2] - '0') - 2][(x->move[1] - 'a') + 1] = '1';
-            }
-          }
-          /* Set destination square */
-          board[RANKS - (x->move[2] - '0')][x->move[1] - 'a'] = c;
-        } else if (strlen(x->move) == 4) {
-          /* Set origin square */
-          if (x->move[1] > '8') { /* It's a letter, i.e. a file, then simply the origin file is given to us */
-            found = 0;
-            if (abs(x->move[1] - x->move[2]) > 1) { /* "Horizontal move", like Nbd7, == 2 */
-              if (x->move[3] < '8' && board[RANKS - (x->move[3] - '0') - 1][x->move[1] - 'a'] == c) {
-                board[RANKS - (x->move[3] - '0') - 1][x->move[1] - 'a'] = '1';
-                found = 1;
-              }
-              if (!found && x->move[3] > '1' && board[RANKS - (x->move[3] - '0') + 1][x->move[1] - 'a'] == c) {
-                board[RANKS - (x->move[3] - '0') + 1][x->move[1] - 'a'] = '1';
-                found = 1;
-              }
-            } else { /* "Vertical move", like Nfe6, == 1 */
-              if (!found && x->move[3] < '7' && board[RANKS - (x->move[3] - '0') - 2][x->move[1] - 'a'] == c) {
-                board[RANKS - (x->move[3] - '0') - 2][x->move[1] - 'a'] = '1';
-                found = 1;
-              }
-              if (!found && x->move[3] > '2' && board[RANKS - (x->move[3] - '0') + 2][x->move[1] - 'a'] == c)
-                board[RANKS - (x->move[3] - '0') + 2][x->move[1] - 'a'] = '1';
-            }
-          } else { /* It's a number, the rank is given */
-            found = 0;
-            if (abs(x->move[1] - x->move[3]) > 1) { /* "Vertical move", like N4e6, == 2 */
-              if (x->move[2] > 'a' && board[RANKS - (x->move[1] - '0')][(x->move[2] - 'a') - 1] == c) {
-                board[RANKS - (x->move[1] - '0')][(x->move[2] - 'a') - 1] = '1';
-                found = 1;
-              }
-              if (!found && x->move[2] < 'h' && board[RANKS - (x->move[1] - '0')][(x->move[1] - 'a') + 1] == c) {
-                board[RANKS - (x->move[1] - '0')][(x->move[1] - 'a') + 1] = '1';
-                found = 1;
-              }
-            } else { /* "Horizontal move", like N4d5, == 1 */
-              if (!found && x->move[2] > 'b' && board[RANKS - (x->move[1] - '0')][(x->move[2] - 'a') - 2] == c) {
-                board[RANKS - (x->move[1] - '0')][(x->move[2] - 'a') - 2] = '1';
-                found = 1;
-              }
-              if (!found && x->move[2] < 'g' && board[RANKS - (x->move[1] - '0')][(x->move[1] - 'a') + 2] == c)
-                board[RANKS - (x->move[1] - '0')][(x->move[1] - 'a') + 2] = '1';
-            }
-          }
-          /* Set destination square */
-          board[RANKS - (x->move[3] - '0')][x->move[2] - 'a'] = c;
-        } else { /* strlen(x->move) == 5), e.g. Nb4d5 */
-          /* Set origin square */
-          board[RANKS - (x->move[2] - '0')][x->move[1] - 'a'] = '1';
-          /* Set destination square */
-          board[RANKS - (x->move[4] - '0')][x->move[3] - 'a'] = c;
-        }
-        enpassant = 0; /* Piece move cancels enpassant opportunity */
-        break;
-      case 'B': /* Bishop move */
-        /* In the ridiculous case that they promote to bishop, we'll have to disambiguate.*/ 
-        /* In the more ridiculous case that there's at least 3 same coloured bishops, we'll have rank and file, e.g. Bg8xd5 */
-        c = (turn)?'B':'b';
-        /* Remove "x" if any */
-        for (i = 0; x->move[i] != '\0'; i++)
-          if (x->move[i] == 'x') {
-            ply = 0; /* Capture resets the halfmove clock */
-            for (j = i; x->move[j] != '\0'; j++)
-              x->move[j] = x->move[j+1];
-            break;
-          }
-        if (strlen(x->move) == 3) {
-          /* Set origin square */
-          for (found = 0, i = 1; i <= RANKS - (x->move[2] - '0') && i <= (x->move[1] - 'a'); i++) /* Upper part  \ */
-            if (board[RANKS - (x->move[2] -'0') - i][(x->move[1] - 'a') - i] == c) {
-              board[RANKS - (x->move[2] -'0') - i][(x->move[1] - 'a') - i] = '1';
-              found = 1;
-              break;
-            } else if  (board[RANKS - (x->move[2] -'0') - i][(x->move[1] - 'a') - i] != '1') /* We hit a piece */
-                break;
-          for (i = 1; !found && i <= RANKS - (x->move[2] - '0') && i <= FILES - (x->move[1] - 'a'); i++) /* Upper part / */
-            if (board[RANKS - (x->move[2] -'0') - i][(x->move[1] - 'a') + i] == c) {
-              board[RANKS - (x->move[2] -'0') - i][(x->move[1] - 'a') + i] = '1';
-              found = 1;
-              break;
-            } else if  (board[RANKS - (x->move[2] -'0') - i][(x->move[1] - 'a') + i] != '1') /* We hit a piece */
-                break;
-          for (i = 1; !found && i <= (x->move[2] - '0') && i <= (x->move[1] - 'a'); i++) /* Lower part \ */
-            if (board[RANKS - (x->move[2] -'0') + i][(x->move[1] - 'a') - i] == c) {
-              board[RANKS - (x->move[2] -'0') + i][(x->move[1] - 'a') - i] = '1';
-              found = 1;
-              break;
-            } else if  (board[RANKS - (x->move[2] -'0') + i][(x->move[1] - 'a') - i] != '1') /* We hit a piece */
-                break;
-          for (i = 1; !found && i <= (x->move[2] - '0') && i <= FILES - (x->move[1] - 'a'); i++) /* Lower part / */
-            if (board[RANKS - (x->move[2] -'0') + i][(x->move[1] - 'a') + i] == c) {
-              board[RANKS - (x->move[2] -'0') + i][(x->move[1] - 'a') + i] = '1';
-              found = 1;
-              break;
-            } else if  (board[RANKS - (x->move[2] -'0') + i][(x->move[1] - 'a') + i] != '1') /* We hit a piece */
-                break;
-          /* Set destination square */
-          board[RANKS - (x->move[2] - '0')][x->move[1] - 'a'] = c;
-        } else if (strlen(x->move) == 4) {
-          /* Set origin square */
-          if (x->move[1] > '8') { /* It's a letter, the origin file is given to us. Bbe4 */
-            if (abs(x->move[1] - x->move[2]) <= RANKS - (x->move[3] - '0') && 
-            board[RANKS - (x->move[3] - '0') - abs(x->move[1] - x->move[2])][x->move[1] - 'a'] == c) /* / */
-              board[RANKS - (x->move[3] - '0') - abs(x->move[1] - x->move[2])][x->move[1] - 'a'] = '1';
-            else if (abs(x->move[1] - x->move[2]) < (x->move[3] - '0') && 
-            board[RANKS - (x->move[3] - '0') + abs(x->move[1] - x->move[2])][x->move[1] - 'a'] == c) /* \ */
-              board[RANKS - (x->move[3] - '0') + abs(x->move[1] - x->move[2])][x->move[1] - 'a'] = '1';
-          }  else { /* It's a number, i.e. the origin rank is given to us */
-            if ((x->move[2] - 'a') + abs(x->move[3] - x->move[1]) < FILES && 
-            board[RANKS - (x->move[1] - '0')][(x->move[2] - 'a') + abs(x->move[3] - x->move[1])] == c) /* / */
-              board[RANKS - (x->move[1] - '0')][(x->move[2] - 'a') + abs(x->move[3] - x->move[1])] = '1';
-            else if (abs(x->move[3] - x->move[1]) < (x->move[2] - 'a') && 
-            board[RANKS - (x->move[1] - '0')][(x->move[2] - 'a') - abs(x->move[3] - x->move[1])] == c) /* \ */
-              board[RANKS - (x->move[1] - '0')][(x->move[2] - 'a') - abs(x->move[3] - x->move[1])] = '1';
-          }
-          /* Set destination square */
-          board[RANKS - (x->move[3] - '0')][x->move[2] - 'a'] = c;
-        } else { /* strlen(x->move) == 5, e.g. Bf5g4*/
-          /* Set origin square */
-          board[RANKS - (x->move[2] - '0')][x->move[1] - 'a'] = '1';
-          /* Set destination square */
-          board[RANKS - (x->move[4] - '0')][x->move[3] - 'a'] = c;
-        }
-        enpassant = 0; /* Piece move cancels enpassant opportunity */
-        break;
-      case 'Q': /* Queen move */
-        c = (turn)?'Q':'q';
-        /* Remove "x" if any */
-        for (i = 0; x->move[i] != '\0'; i++)
-          if (x->move[i] == 'x') {
-            ply = 0; /* Capture resets the halfmove clock */
-            for (j = i; x->move[j] != '\0'; j++)
-              x->move[j] = x->move[j+1];
-            break;
-          }
-        if (strlen(x->move) == 3) {
-          /* Set origin square */
-          /* Bishop-like: */
-          for (found = 0, i = 1; i <= RANKS - (x->move[2] - '0') && i <= (x->move[1] - 'a'); i++) /* Upper part  \ */
-            if (board[RANKS - (x->move[2] -'0') - i][(x->move[1] - 'a') - i] == c) {
-              board[RANKS - (x->move[2] -'0') - i][(x->move[1] - 'a') - i] = '1';
-              found = 1;
-              break;
-            } else if  (board[RANKS - (x->move[2] -'0') - i][(x->move[1] - 'a') - i] != '1') /* We hit a piece */
-                break;
-          for (i = 1; !found && i <= RANKS - (x->move[2] - '0') && i <= FILES - (x->move[1] - 'a'); i++) /* Upper part / */
-            if (board[RANKS - (x->move[2] -'0') - i][(x->move[1] - 'a') + i] == c) {
-              board[RANKS - (x->move[2] -'0') - i][(x->move[1] - 'a') + i] = '1';
-              found = 1;
-              break;
-            } else if  (board[RANKS - (x->move[2] -'0') - i][(x->move[1] - 'a') + i] != '1') /* We hit a piece */
-                break;
-          for (i = 1; !found && i <= (x->move[2] - '0') && i <= (x->move[1] - 'a'); i++) /* Lower part \ */
-            if (board[RANKS - (x->move[2] -'0') + i][(x->move[1] - 'a') - i] == c) {
-              board[RANKS - (x->move[2] -'0') + i][(x->move[1] - 'a') - i] = '1';
-              found = 1;
-              break;
-            } else if  (board[RANKS - (x->move[2] -'0') + i][(x->move[1] - 'a') - i] != '1') /* We hit a piece */
-                break;
-          for (i = 1; !found && i <= (x->move[2] - '0') && i <= FILES - (x->move[1] - 'a'); i++) /* Lower part / */
-            if (board[RANKS - (x->move[2] -'0') + i][(x->move[1] - 'a') + i] == c) {
-              board[RANKS - (x->move[2] -'0') + i][(x->move[1] - 'a') + i] = '1';
-              found = 1;
-              break;
-            } else if  (board[RANKS - (x->move[2] -'0') + i][(x->move[1] - 'a') + i] != '1') /* We hit a piece */
-                break;
-          /* Rook-like: */
-          for (i = RANKS - (x->move[2] - '0') + 1; !found && i < RANKS; i++) /* Look down on the file */
-            if (board[i][x->move[1] - 'a'] == c) {
-              board[i][x->move[1] - 'a'] = '1';
-              found = 1;
-              break;
-            } else if (board[i][x->move[1] - 'a'] != '1') /* We hit a piece */
-              break;
-          for (i = RANKS - (x->move[2] - '0') - 1; !found && i >= 0; i--) /* Look up on the file */
-            if (board[i][x->move[1] - 'a'] == c) {
-              board[i][x->move[1] - 'a'] = '1';
-              found = 1;
-              break;
-            } else if (board[i][x->move[1] - 'a'] != '1') /* We hit a piece */
-              break;
-          for (i = (x->move[1] - 'a') + 1; !found && i < FILES; i++) /* Look to the right on the rank */
-            if (board[RANKS - (x->move[2] - '0')][i] == c) {
-              board[RANKS - (x->move[2] - '0')][i] = '1';
-              found = 1;
-              break;
-            } else if (board[RANKS - (x->move[2] - '0')][i] != '1') /* We hit a piece */
-              break;
-          for (i = (x->move[1] - 'a') - 1; !found && i >= 0; i--) /* Look to the left on the rank */
-            if (board[RANKS - (x->move[2] - '0')][i] == c) {
-              board[RANKS - (x->move[2] - '0')][i] = '1';
-              break;
-            } else if (board[RANKS - (x->move[2] - '0')][i] != '1') /* We hit a piece */
-              break;
-          /* Set destination square */
-          board[RANKS - (x->move[2] - '0')][x->move[1] - 'a'] = c;
-        } else if (strlen(x->move) == 4) {
-          /* Set origin square */
-          /* Bishop-like: */
-          found = 0;
-          if (x->move[1] > '8') { /* It's a letter, the origin file is given to us. Bbe4 */
-            if (abs(x->move[1] - x->move[2]) <= RANKS - (x->move[3] - '0') && 
-            board[RANKS - (x->move[3] - '0') - abs(x->move[1] - x->move[2])][x->move[1] - 'a'] == c) { /* / */
-              board[RANKS - (x->move[3] - '0') - abs(x->move[1] - x->move[2])][x->move[1] - 'a'] = '1';
-              found = 1;
-            } else if (abs(x->move[1] - x->move[2]) < (x->move[3] - '0') && 
-            board[RANKS - (x->move[3] - '0') + abs(x->move[1] - x->move[2])][x->move[1] - 'a'] == c) { /* \ */
-              board[RANKS - (x->move[3] - '0') + abs(x->move[1] - x->move[2])][x->move[1] - 'a'] = '1';
-              found = 1;
-            }
-          }  else { /* It's a number, i.e. the origin rank is given to us */
-            if ((x->move[2] - 'a') + abs(x->move[3] - x->move[1]) < FILES && 
-            board[RANKS - (x->move[1] - '0')][(x->move[2] - 'a') + abs(x->move[3] - x->move[1])] == c) { /* / */
-              board[RANKS - (x->move[1] - '0')][(x->move[2] - 'a') + abs(x->move[3] - x->move[1])] = '1';
-              found = 1;
-            }
-            else if (abs(x->move[3] - x->move[1]) < (x->move[2] - 'a') && 
-            board[RANKS - (x->move[1] - '0')][(x->move[2] - 'a') - abs(x->move[3] - x->move[1])] == c) { /* \ */
-              board[RANKS - (x->move[1] - '0')][(x->move[2] - 'a') - abs(x->move[3] - x->move[1])] = '1';
-              found = 1;
-            }
-          }
-          /* Rook-like: */
-          if (!found && x->move[1] > '8') { /* It's a letter, i.e. a file, then simply the origin file is given to us */
-            if (x->move[1] == x->move[2]) { /* Same file move */
-              for (i = RANKS - (x->move[3] - '0') + 1; i < RANKS; i++) /* Look down on the file */
-                if (board[i][x->move[1] - 'a'] == c) {
-                  board[i][x->move[1] - 'a'] = '1';
-                  found = 1;
-                  break;
-                } else if (board[i][x->move[1] - 'a'] != '1') /* We hit a piece */
-                  break;
-              for (i = RANKS - (x->move[3] - '0') - 1; !found && i >= 0; i--) /* Look up on the file */
-                if (board[i][x->move[1] - 'a'] == c) {
-                  board[i][x->move[1] - 'a'] = '1';
-                  break;
-                } else if (board[i][x->move[1] - 'a'] != '1') /* We hit a piece */
-                  break;
-            } else /* Same rank move */
-              board[RANKS - (x->move[3] - '0')][x->move[1] - 'a'] = '1';
-          }  else if (!found) { /* It's a number, i.e. the origin rank is given to us */
-            if (x->move[1] == x->move[3]) { /* Same rank move */
-              for (i = (x->move[2] - 'a') + 1; i < FILES; i++) /* Look to the right on the rank */
-                if (board[RANKS - (x->move[1] - '0')][i] == c) {
-                  board[RANKS - (x->move[1] - '0')][i] = '1';
-                  found = 1;
-                  break;
-                } else if (board[RANKS - (x->move[1] - '0')][i] != '1') /* We hit a piece */
-                  break;
-              for (i = (x->move[2] - 'a') - 1; !found && i >= 0; i--) /* Look to the left on the rank */
-                if (board[RANKS - (x->move[1] - '0')][i] == c) {
-                  board[RANKS - (x->move[1] - '0')][i] = '1';
-                  break;
-                } else if (board[RANKS - (x->move[1] - '0')][i] != '1') /* We hit a piece */
-                  break;
-            } else /* Same file move */
-              board[RANKS - (x->move[1] - '0')][x->move[2] - 'a'] = '1';
-          }
-          /* Set destination square */
-          board[RANKS - (x->move[3] - '0')][x->move[2] - 'a'] = c;
-        } else { /* strlen(x->move) == 5, e.g. Qf5g4 */
-          /* Set origin square */
-          board[RANKS - (x->move[2] - '0')][x->move[1] - 'a'] = '1';
-          /* Set destination square */
-          board[RANKS - (x->move[4] - '0')][x->move[3] - 'a'] = c;
-        }
-        enpassant = 0; /* Piece move cancels enpassant opportunity */
-        break;
-      case 'K': /* King move */
-        /* No need to disambiguate! There's never more than 1 king per-side. Halleluja! */
-        c = (turn)?'K':'k';
-        /* Remove "x" if any */
-        for (i = 0; x->move[i] != '\0'; i++)
-          if (x->move[i] == 'x') {
-            ply = 0; /* Capture resets the halfmove clock */
-            for (j = i; x->move[j] != '\0'; j++)
-              x->move[j] = x->move[j+1];
-            break;
-          }
-        /* Set origin square */
-        found = 0;
-        if (x->move[2] > '1') { /* Below */
-          found = 1;
-          if (board[RANKS - (x->move[2] - '0') + 1][x->move[1] - 'a'] == c)
-            board[RANKS - (x->move[2] - '0') + 1][x->move[1] - 'a'] = '1';
-          else if (x->move[1] > 'a' && board[RANKS - (x->move[2] - '0') + 1][(x->move[1] - 'a') - 1] == c)
-            board[RANKS - (x->move[2] - '0') + 1][(x->move[1] - 'a') - 1] = '1';
-          else if (x->move[1] < 'h' && board[RANKS - (x->move[2] - '0') + 1][(x->move[1] - 'a') + 1] == c)
-            board[RANKS - (x->move[2] - '0') + 1][(x->move[1] - 'a') + 1] = '1';
-          else
-            found = 0;
-        }
-        if (!found && x->move[2] < '8') { /* Above */
-          found = 1;
-          if (board[RANKS - (x->move[2] - '0') - 1][x->move[1] - 'a'] == c)
-            board[RANKS - (x->move[2] - '0') - 1][x->move[1] - 'a'] = '1';
-          else if (x->move[1] > 'a' && board[RANKS - (x->move[2] - '0') - 1][(x->move[1] - 'a') - 1] == c)
-            board[RANKS - (x->move[2] - '0') - 1][(x->move[1] - 'a') - 1] = '1';
-          else if (x->move[1] < 'h' && board[RANKS - (x->move[2] - '0') - 1][(x->move[1] - 'a') + 1] == c)
-            board[RANKS - (x->move[2] - '0') - 1][(x->move[1] - 'a') + 1] = '1';
-          else
-            found = 0;
-        }
-        if (!found && x->move[1] > 'a' && board[RANKS - (x->move[2] - '0')][(x->move[1] - 'a') - 1] == c) { /* Left */
-          board[RANKS - (x->move[2] - '0')][(x->move[1] - 'a') - 1] = '1';
-          found = 1;
-        }
-        if (!found && x->move[1] < 'h' && board[RANKS - (x->move[2] - '0')][(x->move[1] - 'a') + 1] == c) /* Right */
-          board[RANKS - (x->move[2] - '0')][(x->move[1] - 'a') + 1] = '1';
-        /* Set destination square */
-        board[RANKS - (x->move[2] - '0')][x->move[1] - 'a'] = c;
-        /* If you move your king you lose castling privileges */
-        if (turn)
-          castling &= ~(CASTLEK | CASTLEQ);
-        else
-          castling &= ~(CASTLEk | CASTLEq);
-        break;
-        enpassant = 0; /* Piece move cancels enpassant opportunity */
-      case 'O': /* Castling */
-        if (strlen(x->move) == 3) /* O-O */
-          if (turn) { /* I could do smth crazy to save the if, like board[7*(1-turn)][]. But 1 "if" is faster than 4 multiplications, is it? */
-            board[7][4] = '1';
-            board[7][5] = 'R';
-            board[7][6] = 'K';
-            board[7][7] = '1';
-          } else {
-            board[0][4] = '1';
-            board[0][5] = 'r';
-            board[0][6] = 'k';
-            board[0][7] = '1';
-          }
-        else /* strlen(x->move) == 5; O-O-O */ 
-          if (turn) {
-            board[7][0] = '1';
-            board[7][2] = 'K';
-            board[7][3] = 'R';
-            board[7][4] = '1';
-          } else {
-            board[0][0] = '1';
-            board[0][2] = 'k';
-            board[0][3] = 'r';
-            board[0][4] = '1';
-          }
-        /* If you have castled, then you can't castle anymore */
-        if (turn)
-          castling &= ~(CASTLEK | CASTLEQ);
-        else
-          castling &= ~(CASTLEk | CASTLEq);
-        break;
-        enpassant = 0; /* Piece move cancels enpassant opportunity */
-    }
-    x = x->next;
-    turn = (turn)?BLACK:WHITE; /* Toggle turn */
-  }
-
-  /* Print the first field of the FEN */
-  for (i = 0; i < RANKS-1; i++) {
-    c = '0'; /* We'll accumulate the 1's in "c". Reset it for every rank */
-    for (j = 0; j < FILES; j++) 
-      if ('1' == board[i][j])
-        c++; /* ;-P */ 
-      else { 
-        fprintf(foutput, "%c%c", (c != '0')?c:'\0', board[i][j]); /* If we haven't accumulated 1's, don't print c */
-        c = '0';
-      }
-    if (c > '0') /* We finished the loop with accumulated 1's! Print it */
-        fprintf(foutput, "%c", c);
-    fprintf(foutput, "/");
-  }
-  /* The last rank doesn't have "/", so print it now */
-  c = '0';
-  for (i = RANKS-1, j = 0; j < FILES; j++)
-    if ('1' == board[i][j])
-      c++; /* ;-P */ 
-    else { 
-      fprintf(foutput, "%c%c", (c != '0')?c:'\0', board[i][j]); /* If we haven't accumulated 1's, don't print c */
-      c = '0';
-    }
-  if (c > '0') /* We finished the loop with accumulated 1's! Print it */
-    fprintf(foutput, "%c", c);
-
-  /* Print the second field of the FEN */
-  /* This field uses the opposite interpretation that we used for the argument "side" */
-  /* In ours, "w" means: position after white's move (meaning black moves next) */
-  fprintf(foutput, " %c ", (side == 'w')?'b':'w');
-
-  /* Print the third field of the FEN */
-  if (!castling)
-    fprintf(foutput, "- ");
-  else  
-    fprintf(foutput, "%c%c%c%c ", (castling & CASTLEK)?'K':'\0', (castling & CASTLEQ)?'Q':'\0', 
-                                  (castling & CASTLEk)?'k':'\0', (castling & CASTLEq)?'q':'\0');
-
-  /* Print the fourth field of the FEN */
-  if (enpassant)
-    fprintf(foutput, "%c%d ", target, (side == 'w')?3:6);
-  else
-    fprintf(foutput, "- ");
+  if (game) /* Straight to it */
+    seek_game(&in, argv[1], game);
+  else if (database) { /* Every game in the file */
+    if (threads > 1 && !in.binary) { /* Binary databases have no tags to cut them at, and need no help */
+      while (pgn2fen_refill(&in)); /* We need all of it to cut it in pieces */
+      process_games_parallel(&in, foutput, &opts);
+    } else
+      process_games(&in, foutput, &opts, 1, NULL);
+    if (in.error) {
+      printf("*** Error: %s\n", pgn2fen_strerror(in.error));
+      exit(EXIT_FAILURE);
+    }
+    if (stats) {
+      fflush(foutput);
+      print_stats(stats, clocks(NULL) - started);
+    }
+    exit(EXIT_SUCCESS);
+  }
 
-  /* Print the fifth field of the FEN */
-  fprintf(foutput, "%d ", ply);
-  
-  /* Print the sixth field of the FEN */
-  /* Full move: It starts at 1, and is incremented after Black's move. We have the move number in "move" */
-  /* All we need to do is add 1 to that if it's the position after black moved, as indicated by "side" */
-  fprintf(foutput, "%d\n", (side == 'w')?move:move+1);
+  /* Only one game, the first unless we were given another, and we stop as soon as we get there */
+  i = play_game(&in, foutput, &opts, (database)?game:0, 1, &offset, &illegal);
+  if (in.error) {
+    printf("*** Error: %s\n", pgn2fen_strerror(in.error));
+    exit(EXIT_FAILURE);
+  } else if (illegal) {
+    printf("*** Error: The game has a move that can't be played\n");
+    exit(EXIT_FAILURE);
+  } else if (i < plies) {
+    printf("*** Error: Move number %d by %s does not exist\n", move, (side == 'w')?"white":"black");
+    exit(EXIT_FAILURE);
+  }
+  if (stats) {
+    fflush(foutput);
+    print_stats(stats, clocks(NULL) - started);
+  }
 
   exit(EXIT_SUCCESS);
 
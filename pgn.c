@@ -0,0 +1,567 @@
+/*
+ *  pgn2fen - Extracts FEN of a specific move on a PGN game
+ *  -------------------------------------------------------
+ *  Author: mate_amargo - Juan Alberto Regalado Galván
+ *  https://github.com/mate-amargo/pgn2fen
+ *  -------------------------------------------------------
+ *
+ *  Reading PGN: the input, the tokenizer and replaying games move by move
+ */
+
+#include <string.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "board.h"
+
+/* Tell binary databases from PGN by their first bytes, and skip their header */
+static void check_binary (struct pgn2fen_input *in) {
+  while (in->size < BINARYHEADER && pgn2fen_refill(in));
+  if (in->size >= BINARYHEADER && !memcmp(in->data, BINARYMAGIC, strlen(BINARYMAGIC))) {
+    in->binary = 1;
+    in->pos = BINARYHEADER;
+  }
+}
+
+/* Map the whole file. Pipes and the like are read as we need them. "-" is stdin. Compressed input is */
+/* told by its first bytes and decompressed on the fly, whether it comes from a file or a pipe. So are */
+/* binary databases, which are read the same way as PGN */
+static int open_input (const char *path, struct pgn2fen_input *in) {
+
+  struct stat st;
+  void *map;
+  ssize_t n;
+  int format, error;
+
+  pgn2fen_init_scan();
+  memset(in, 0, sizeof(*in));
+  if (!strcmp(path, "-"))
+    in->fd = STDIN_FILENO;
+  else if ((in->fd = open(path, O_RDONLY)) < 0)
+    return PGN2FEN_EOPEN;
+  map = NULL;
+  if (fstat(in->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, in->fd, 0);
+    if (map != MAP_FAILED) {
+      madvise(map, st.st_size, MADV_SEQUENTIAL); /* It's just a hint, we don't care if it fails */
+      if (!pgn2fen_compressed(map, st.st_size)) {
+        in->data = map;
+        in->size = st.st_size;
+        in->mapped = in->eof = 1;
+        STAT(bytes, in->size);
+        check_binary(in);
+        return PGN2FEN_OK;
+      }
+    } else
+      map = NULL;
+  }
+  in->cap = 1 << 16;
+  if ((in->buf = malloc(in->cap)) == NULL) {
+    if (map)
+      munmap(map, st.st_size);
+    pgn2fen_close(in);
+    return PGN2FEN_ENOMEM;
+  }
+  in->data = in->buf;
+  if (map) /* The decoder reads it from the mapping, and lets go of it when it's done */
+    error = pgn2fen_start_decoder(in, pgn2fen_compressed(map, st.st_size), NULL, 0, map, st.st_size);
+  else {
+    /* We need a look at the first bytes to tell if it's compressed. If it isn't, they're the first of the window */
+    while (in->size < 4 && (n = read(in->fd, in->buf + in->size, 4 - in->size)) > 0) {
+      in->size += n;
+      STAT(bytes, n);
+    }
+    if (!(format = pgn2fen_compressed((unsigned char *) in->buf, in->size))) {
+      check_binary(in);
+      return PGN2FEN_OK;
+    }
+    error = pgn2fen_start_decoder(in, format, (unsigned char *) in->buf, in->size, NULL, 0);
+    in->size = 0;
+  }
+  if (error < 0) {
+    if (map)
+      munmap(map, st.st_size);
+    pgn2fen_close(in);
+    return error;
+  }
+  check_binary(in);
+  return PGN2FEN_OK;
+}
+
+int pgn2fen_open (const char *path, struct pgn2fen_input *in) {
+  STAT_TIMER;
+  int error;
+  STAT_START();
+  error = open_input(path, in);
+  STAT_STOP(openwall, opencpu);
+  return error;
+}
+
+/* Read PGN that is already in memory. It isn't copied, so it has to stay there until we are done */
+void pgn2fen_open_memory (const char *data, size_t size, struct pgn2fen_input *in) {
+  pgn2fen_init_scan();
+  memset(in, 0, sizeof(*in));
+  in->fd = -1;
+  in->data = data;
+  in->size = size;
+  in->eof = 1;
+  STAT(bytes, size);
+  check_binary(in);
+}
+
+void pgn2fen_close (struct pgn2fen_input *in) {
+  if (in->decoder)
+    pgn2fen_stop_decoder(in);
+  if (in->mapped)
+    munmap((void *) in->data, in->size);
+  free(in->buf);
+  if (in->fd >= 0 && in->fd != STDIN_FILENO)
+    close(in->fd);
+  in->data = in->buf = NULL;
+  in->fd = -1;
+}
+
+/* Read some more of a pipe, or decompress some more. What comes before "pos" is dropped, so anything */
+/* pointing into the window is no longer valid. Returns 0 if there's nothing more to read, "error" tells if that's because something failed */
+static int refill (struct pgn2fen_input *in) {
+  char *tmp;
+  ssize_t n;
+  memmove(in->buf, in->buf + in->pos, in->size - in->pos);
+  in->base += in->pos;
+  in->size -= in->pos;
+  in->pos = 0;
+  if (in->size == in->cap) { /* A really long token, make room */
+    if ((tmp = realloc(in->buf, 2*in->cap)) == NULL) {
+      in->error = PGN2FEN_ENOMEM;
+      in->eof = 1;
+      return 0;
+    }
+    in->buf = tmp;
+    in->cap *= 2;
+  }
+  in->data = in->buf;
+  if (in->decoder) { /* Take what the decoder has ready */
+    if (!pgn2fen_decoded(in)) {
+      in->eof = 1;
+      return 0;
+    }
+    return 1;
+  }
+  if ((n = read(in->fd, in->buf + in->size, in->cap - in->size)) <= 0) {
+    if (n < 0)
+      in->error = PGN2FEN_EREAD;
+    in->eof = 1;
+    return 0;
+  }
+  in->size += n;
+  STAT(bytes, n);
+  return 1;
+}
+
+int pgn2fen_refill (struct pgn2fen_input *in) {
+  STAT_TIMER;
+  int more;
+  if (in->eof)
+    return 0;
+  STAT_START();
+  more = refill(in);
+  STAT_STOP(readwall, readcpu);
+  return more;
+}
+
+/* Find the next token of the movetext. Move numbers, commentaries, variations and NAGs are */
+/* eaten on the way. "start" gets the offset where the token begins. For moves, "move" and "len" */
+/* point to the move inside the input, checks and annotations like "+" or "!?" are left out. */
+/* They are only good until we read the next token */
+int pgn2fen_read_token (struct pgn2fen_input *in, const char **move, int *len, size_t *start) {
+
+  const char *p, *end, *word, *q;
+
+  for (;;) {
+    p = in->data + in->pos;
+    end = in->data + in->size;
+    while (p < end && isspace((unsigned char) *p))
+      p++;
+    in->pos = p - in->data;
+    *start = in->base + in->pos;
+    if (p == end) {
+      if (pgn2fen_refill(in))
+        continue;
+      return PGN2FEN_TOKEN_EOF;
+    }
+    switch (*p) {
+      case '[': /* It's a tag, let the caller know. It's left unread */
+        STAT(tokens, 1);
+        return PGN2FEN_TOKEN_TAG;
+      case ')': /* A variation ends. If we aren't following them, it's one that never began */
+        in->pos++;
+        if (!in->variations)
+          continue;
+        STAT(tokens, 1);
+        return PGN2FEN_TOKEN_VARIATION_END;
+      case '(': /* Variation, read past it. It may have variations of its own */
+        if (in->variations) {
+          in->pos++;
+          STAT(tokens, 1);
+          return PGN2FEN_TOKEN_VARIATION;
+        }
+        /* fall through */
+      case '{': /* Commentary, read past it */
+      case ';': /* Rest of line commentary */
+        if ('(' == *p)
+          q = pgn2fen_skip_variation(p, end);
+        else if ((q = pgn2fen_scan(p + 1, end, ('{' == *p)?"}":"\n", 1)) == end)
+          q = NULL;
+        STAT(commentbytes, ((q)?q + 1:end) - p);
+        if (q)
+          in->pos = q + 1 - in->data;
+        else if (!pgn2fen_refill(in)) /* It goes on, unless the file is over */
+          in->pos = in->size;
+        continue;
+    }
+    /* Find the end of the word */
+    for (word = p; p < end && !isspace((unsigned char) *p) && !strchr("[({;)", *p); p++);
+    if (p == end) { /* It might go on */
+      if (pgn2fen_refill(in))
+        continue;
+      word = in->data + in->pos; /* It doesn't, but the window may have moved */
+      p = in->data + in->size;
+    }
+    in->pos = p - in->data;
+    if ((p - word == 3 && (!memcmp(word, "1-0", 3) || !memcmp(word, "0-1", 3))) ||
+        (p - word == 7 && !memcmp(word, "1/2-1/2", 7)) || (p - word == 1 && '*' == *word)) {
+      STAT(tokens, 1);
+      return PGN2FEN_TOKEN_RESULT;
+    }
+    if ('$' == *word) /* NAGs like $1 are not moves */
+      continue;
+    /* Distinguish between move numbers and things like R2xf4: a move number is followed by dots */
+    for (q = word; q < p && isdigit((unsigned char) *q); q++);
+    if (q > word && q < p && '.' == *q)
+      for (word = q; word < p && '.' == *word; word++);
+    /* Trim whatever is not part of the move, like "+" or "!?" */
+    for (q = p; q > word && !strchr("abcdefghRNBQKxO-=12345678", q[-1]); q--);
+    if (q > word) {
+      *move = word;
+      *len = q - word;
+      STAT(tokens, 1);
+      return PGN2FEN_TOKEN_MOVE;
+    }
+  }
+}
+
+/* Read past the end of the line, used for tags */
+static void skip_line (struct pgn2fen_input *in) {
+  const char *eol;
+  while ((eol = pgn2fen_scan(in->data + in->pos, in->data + in->size, "\n", 1)) == in->data + in->size) {
+    STAT(tagbytes, in->size - in->pos);
+    in->pos = in->size; /* We don't need any of it */
+    if (!pgn2fen_refill(in))
+      return;
+  }
+  STAT(tagbytes, eol + 1 - (in->data + in->pos));
+  in->pos = eol + 1 - in->data;
+}
+
+/* Keep the value of the tag line we are at, and land on the next line */
+static void read_tag (struct pgn2fen_input *in, struct pgn2fen_tags *tags) {
+  const char *eol;
+  /* The whole line has to be in the window. What's before "pos" may go, but not the line */
+  while ((eol = pgn2fen_scan(in->data + in->pos, in->data + in->size, "\n", 1)) == in->data + in->size &&
+         pgn2fen_refill(in));
+  STAT(tagbytes, eol - (in->data + in->pos));
+  pgn2fen_read_tag(in->data + in->pos, eol, tags);
+  in->pos = eol - in->data + (eol < in->data + in->size);
+}
+
+/* Look at a line of PGN, from "*line" up to "end" past its end of line, for whoever reads through the */
+/* movetext a line at a time without looking at the moves: the game index and games filtered out. */
+/* "comment" is set while a "{" commentary that began on an earlier line is still open, and is left set */
+/* if one is still open at the end of this one, so a "[" beginning a line inside one isn't taken for a */
+/* tag. "linestart" says if "*line" is the beginning of the line or somewhere after it. When it is, */
+/* "*line" is moved to the first thing on the line */
+int pgn2fen_skim_line (const char **line, const char *end, int *comment, int linestart) {
+  const char *p = *line, *semicolon;
+  if (*comment) {
+    if ((p = memchr(p, '}', end - p)) == NULL)
+      return PGN2FEN_LINE_MOVETEXT;
+    *comment = 0;
+  } else if (linestart) {
+    while (p < end && (' ' == *p || '\t' == *p || '\r' == *p || '\n' == *p))
+      p++;
+    *line = p;
+    if (p == end || '%' == *p)
+      return PGN2FEN_LINE_EMPTY;
+    if ('[' == *p)
+      return PGN2FEN_LINE_TAG;
+  }
+  /* Whatever follows a ";" is a commentary too */
+  semicolon = memchr(p, ';', end - p);
+  while ((p = memchr(p, '{', ((semicolon)?semicolon:end) - p)) != NULL) {
+    if ((p = memchr(p, '}', end - p)) == NULL) {
+      *comment = 1;
+      break;
+    }
+    semicolon = memchr(p, ';', end - p);
+  }
+  return PGN2FEN_LINE_MOVETEXT;
+}
+
+/* Read past the rest of the movetext without looking at the moves, up to the tags of the next game. As */
+/* with the game index, this is where the game ends as long as the next one has tags */
+static void skip_movetext (struct pgn2fen_input *in) {
+
+  const char *p, *q, *next;
+  int linestart = 0, comment = 0;
+
+  for (;;) {
+    p = in->data + in->pos;
+    if ((next = memchr(p, '\n', in->size - in->pos)) == NULL) { /* We need the whole line */
+      if (pgn2fen_refill(in))
+        continue;
+      STAT(commentbytes, in->size - in->pos);
+      in->pos = in->size;
+      return;
+    }
+    next++;
+    q = p;
+    if (PGN2FEN_LINE_TAG == pgn2fen_skim_line(&q, next, &comment, linestart)) { /* The next game */
+      in->pos = q - in->data;
+      return;
+    }
+    STAT(commentbytes, next - p);
+    in->pos = next - in->data;
+    linestart = 1;
+  }
+}
+
+/* The first move of the game is here, so its tags are all read. If they don't pass the filter of the */
+/* input, the game is read past and over. Returns whether it is */
+static int filter_out (struct pgn2fen_input *in, struct pgn2fen_game *g) {
+  if (g->movetext || !in->filter || pgn2fen_filter_match(in->filter, &g->tags))
+    return 0;
+  skip_movetext(in);
+  g->filtered = g->over = 1;
+  g->next = in->base + in->pos;
+  return 1;
+}
+
+/* Ready to read a game, from the initial position */
+void pgn2fen_init_game (struct pgn2fen_game *g) {
+  pgn2fen_init_position(&g->pos);
+  g->ply = g->started = g->movetext = g->over = 0;
+  g->offset = g->next = 0;
+  g->move = 0;
+  g->left = g->stopped = 0;
+  g->filtered = 0;
+  memset(&g->tags, 0, sizeof(g->tags));
+}
+
+/* Read and play the next move of the game. If "play" is not set the moves are read but not played. */
+/* Returns 1 if there was a move, 0 if the game is over, or an error if the move couldn't be played or */
+/* the input couldn't be read */
+int pgn2fen_next_move (struct pgn2fen_input *in, struct pgn2fen_game *g, int play) {
+
+  const char *move;
+  size_t start;
+  int len, token, error;
+
+  if (in->binary)
+    return pgn2fen_next_binary_move(in, g, play);
+  while (!g->over) {
+    if ((token = pgn2fen_read_token(in, &move, &len, &start)) == PGN2FEN_TOKEN_EOF)
+      break;
+    if (!g->started) {
+      g->started = 1;
+      g->offset = start;
+    }
+    switch (token) {
+      case PGN2FEN_TOKEN_TAG:
+        if (g->movetext) /* The tags of the next game, this one is over */
+          g->over = 1;
+        else if (in->tags || in->filter)
+          read_tag(in, &g->tags);
+        else
+          skip_line(in);
+        break;
+      case PGN2FEN_TOKEN_RESULT:
+        g->over = 1;
+        break;
+      case PGN2FEN_TOKEN_MOVE:
+        if (filter_out(in, g))
+          return 0;
+        g->movetext = 1;
+        g->next = in->base + in->pos;
+        if (!play)
+          return 1;
+        if ((error = pgn2fen_play_san(&g->pos, move, len, &g->move)) < 0)
+          return error;
+        g->ply++;
+        STAT(plies, 1);
+        return 1;
+    }
+  }
+  g->over = 1;
+  g->next = in->base + in->pos;
+  return in->error;
+}
+
+/* Ready to follow the variations of a game, from the beginning of its main line */
+void pgn2fen_init_variations (struct pgn2fen_variations *v) {
+  pgn2fen_init_position(&v->prev);
+  v->moved = v->depth = v->closed = v->skipping = v->failed = v->errors = 0;
+}
+
+/* A variation begins: it replaces the last move of the line we are in, so it starts from the position */
+/* before it. The line is put aside as it is, to pick it up again when the variation ends */
+static void begin_variation (struct pgn2fen_game *g, struct pgn2fen_variations *v) {
+  struct pgn2fen_branch *b;
+  if (PGN2FEN_MAXNESTING == v->depth) { /* Too deep, read past it */
+    v->skipping = 1;
+    return;
+  }
+  b = &v->stack[v->depth++];
+  b->pos = g->pos;
+  b->prev = v->prev;
+  b->move = g->move;
+  b->moved = v->moved;
+  b->ply = g->ply;
+  b->number = v->closed + 1; /* Right after another one, it's an alternative to the same move */
+  g->pos = v->prev;
+  if (v->moved)
+    g->ply--;
+  v->moved = v->closed = 0;
+}
+
+static void end_variation (struct pgn2fen_game *g, struct pgn2fen_variations *v) {
+  struct pgn2fen_branch *b;
+  if (!v->depth) /* One that never began */
+    return;
+  b = &v->stack[--v->depth];
+  g->pos = b->pos;
+  v->prev = b->prev;
+  g->move = b->move;
+  v->moved = b->moved;
+  g->ply = b->ply;
+  v->closed = b->number;
+}
+
+/* Same as pgn2fen_next_move, but variations are followed too, as they come: the moves of each one are */
+/* played from the position where it branches off, and then the line it branches off carries on. "v" */
+/* tells which variation the move belongs to. A variation with a move that can't be played is given up */
+/* and counted in v->errors, only the main line ends the game that way. The input must have "variations" set */
+int pgn2fen_next_variation_move (struct pgn2fen_input *in, struct pgn2fen_game *g, struct pgn2fen_variations *v) {
+
+  struct pgn2fen_position before;
+  const char *move;
+  size_t start;
+  int len, token, error;
+
+  if (in->binary) /* There are no variations in them */
+    return pgn2fen_next_binary_move(in, g, 1);
+  while (!g->over) {
+    if ((token = pgn2fen_read_token(in, &move, &len, &start)) == PGN2FEN_TOKEN_EOF)
+      break;
+    if (!g->started) {
+      g->started = 1;
+      g->offset = start;
+    }
+    switch (token) {
+      case PGN2FEN_TOKEN_TAG:
+        if (g->movetext)
+          g->over = 1;
+        else if (in->tags || in->filter)
+          read_tag(in, &g->tags);
+        else
+          skip_line(in);
+        break;
+      case PGN2FEN_TOKEN_RESULT:
+        g->over = 1;
+        break;
+      case PGN2FEN_TOKEN_VARIATION:
+        if (v->skipping)
+          v->skipping++;
+        else
+          begin_variation(g, v);
+        break;
+      case PGN2FEN_TOKEN_VARIATION_END:
+        if (!v->skipping)
+          end_variation(g, v);
+        else if (!--v->skipping && v->failed) { /* The end of the one we gave up */
+          v->failed = 0;
+          end_variation(g, v);
+        }
+        break;
+      case PGN2FEN_TOKEN_MOVE:
+        if (filter_out(in, g))
+          return 0;
+        g->movetext = 1;
+        g->next = in->base + in->pos;
+        if (v->skipping)
+          break;
+        before = g->pos;
+        if ((error = pgn2fen_play_san(&g->pos, move, len, &g->move)) < 0) {
+          if (!v->depth)
+            return error;
+          g->pos = before;
+          v->errors++;
+          v->skipping = v->failed = 1;
+          break;
+        }
+        v->prev = before;
+        v->moved = 1;
+        v->closed = 0;
+        g->ply++;
+        STAT(plies, 1);
+        return 1;
+    }
+  }
+  g->over = 1;
+  g->next = in->base + in->pos;
+  return in->error;
+}
+
+/* Read what's left of the game without playing it, to land on the next one */
+void pgn2fen_skip_game (struct pgn2fen_input *in, struct pgn2fen_game *g) {
+  while (pgn2fen_next_move(in, g, 0) > 0);
+}
+
+/* Find the first game that begins at or after "from". To be sure we don't land inside a commentary we only */
+/* trust tags at the start of a line after an empty one, like "\n\n[Event ". Returns the size of the file if there's none */
+size_t pgn2fen_next_game_start (const struct pgn2fen_input *in, size_t from) {
+  const char *p = in->data + from, *end = in->data + in->size, *q;
+  while ((p = memchr(p, '[', end - p)) != NULL) {
+    q = p;
+    if (q + 1 < end && isalpha((unsigned char) q[1]) && q - 1 > in->data && '\n' == *--q) {
+      if ('\r' == q[-1])
+        q--;
+      if (q - 1 >= in->data && '\n' == q[-1])
+        return p - in->data;
+    }
+    p++;
+  }
+  return in->size;
+}
+/* What went wrong, in words */
+const char *pgn2fen_strerror (int error) {
+  switch (error) {
+    case PGN2FEN_OK: return "No error";
+    case PGN2FEN_EOPEN: return "The input could not be opened";
+    case PGN2FEN_ENOMEM: return "Out of memory";
+    case PGN2FEN_EREAD: return "The input could not be read";
+    case PGN2FEN_ESAN: return "Not a move";
+    case PGN2FEN_EILLEGAL: return "A move that can't be played";
+    case PGN2FEN_ENOSPACE: return "The buffer is too small";
+    case PGN2FEN_EFEN: return "Invalid FEN";
+    case PGN2FEN_EWRITE: return "The output could not be written";
+    case PGN2FEN_EFORMAT: return "The file isn't what we expected, or it's damaged";
+    case PGN2FEN_ESTALE: return "The PGN changed after its index was built, build it again";
+    case PGN2FEN_EDECOMPRESS: return "The input is damaged, or compressed in a way we can't read";
+    case PGN2FEN_EFILTER: return "The filter on the tags doesn't make sense";
+  }
+  return "Unknown error";
+}
@@ -0,0 +1,315 @@
+/*
+ *  libpgn2fen - Replays PGN games and gives the FEN of any position
+ *  ----------------------------------------------------------------
+ *  Author: mate_amargo - Juan Alberto Regalado Galván
+ *  https://github.com/mate-amargo/pgn2fen
+ *  ----------------------------------------------------------------
+ *
+ *  Nothing in here exits or prints: functions that can fail return one of the
+ *  PGN2FEN_E* codes, which are all negative. There are no globals besides the
+ *  attack and Zobrist tables, which are filled once and only read afterwards, so different
+ *  threads can use the library at the same time as long as they don't share
+ *  a position, a game or an input.
+ *
+ *  The least you need:
+ *
+ *    struct pgn2fen_input in;
+ *    struct pgn2fen_game g;
+ *    char fen[PGN2FEN_FENSIZE];
+ *
+ *    pgn2fen_open("game.pgn", &in);
+ *    pgn2fen_init_game(&g);
+ *    while (g.ply < 3 && pgn2fen_next_move(&in, &g, 1) > 0);
+ *    pgn2fen_fen(&g.pos, fen, sizeof(fen));
+ *    pgn2fen_close(&in);
+ */
+
+#ifndef PGN2FEN_H
+#define PGN2FEN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PGN2FEN_OK 0
+#define PGN2FEN_EOPEN -1     /* The input could not be opened */
+#define PGN2FEN_ENOMEM -2    /* Out of memory */
+#define PGN2FEN_EREAD -3     /* The input could not be read */
+#define PGN2FEN_ESAN -4      /* Something in the movetext that looks like a move but isn't one */
+#define PGN2FEN_EILLEGAL -5  /* A move no piece can make */
+#define PGN2FEN_ENOSPACE -6  /* The buffer is too small */
+#define PGN2FEN_EFEN -7      /* A FEN that doesn't make sense */
+#define PGN2FEN_EWRITE -8    /* The output could not be written */
+#define PGN2FEN_EFORMAT -9   /* A file that isn't what we expected, like an index that isn't one */
+#define PGN2FEN_ESTALE -10   /* The PGN changed since its index was built */
+#define PGN2FEN_EDECOMPRESS -11 /* Compressed input that is damaged, or in a format we weren't built to read */
+#define PGN2FEN_EFILTER -12  /* A filter on the tags that doesn't make sense */
+
+#define PGN2FEN_FENSIZE 128  /* Enough room for any FEN, with its terminating '\0' */
+
+#define PGN2FEN_TOKEN_EOF 0     /* Kinds of tokens returned by pgn2fen_read_token */
+#define PGN2FEN_TOKEN_MOVE 1
+#define PGN2FEN_TOKEN_RESULT 2  /* 1-0, 0-1, 1/2-1/2 or * */
+#define PGN2FEN_TOKEN_TAG 3     /* A "[" was found. It's left unread so the caller decides what to do */
+#define PGN2FEN_TOKEN_VARIATION 4     /* "(" and ")", only if the input follows variations. Otherwise */
+#define PGN2FEN_TOKEN_VARIATION_END 5 /* they are read past with everything inside them */
+
+#define PGN2FEN_MAXNESTING 32 /* Variations nested deeper than this are read past, not followed */
+
+#define PGN2FEN_TAGSIZE 64 /* Longest tag value we keep, with its '\0'. Longer ones are cut */
+#define PGN2FEN_MAXCONDITIONS 16 /* In a filter on the tags */
+#define PGN2FEN_EQ 0 /* How a condition compares a tag with its value */
+#define PGN2FEN_NE 1
+#define PGN2FEN_LT 2
+#define PGN2FEN_LE 3
+#define PGN2FEN_GT 4
+#define PGN2FEN_GE 5
+
+typedef uint64_t pgn2fen_bitboard; /* A set of squares, one bit per square, a1 = 0, b1 = 1, ... h8 = 63 */
+
+/* A move in 16 bits: the origin square in the low 6, the destination in the next 6, and the piece a pawn */
+/* promotes to in the next 3 (1 knight, 2 bishop, 3 rook, 4 queen, 0 if it doesn't). Castling is the king's move */
+typedef uint16_t pgn2fen_move;
+
+#define PGN2FEN_MOVE(from, to, promotion) ((pgn2fen_move) ((from) | (to) << 6 | (promotion) << 12))
+#define PGN2FEN_MOVE_FROM(m) ((m) & 63)
+#define PGN2FEN_MOVE_TO(m) (((m) >> 6) & 63)
+#define PGN2FEN_MOVE_PROMOTION(m) (((m) >> 12) & 7)
+#define PGN2FEN_MAXMOVES 256 /* No position has more legal moves than this */
+
+/* Everything we need to know about the game while we replay it */
+struct pgn2fen_position {
+  pgn2fen_bitboard pieces[6]; /* One set per piece type, of both colours: pawns, knights, bishops, rooks, queens and kings */
+  pgn2fen_bitboard colour[2]; /* All the pieces of each colour, black first */
+  pgn2fen_bitboard occupied;
+  int castling; /* Third field of the FEN: KQkq, each letter represents a bit, K being the highest */
+  int turn; /* 1 for white, 0 for black */
+  int enpassant; /* Enpassant target square, -1 if the last move wasn't a double pawn push */
+  int ply; /* The ply clock, the fifth field of the FEN */
+  int fullmove; /* Sixth field of the FEN */
+  uint64_t key; /* Zobrist key of the position: the pieces, castling rights, enpassant file if a pawn can take on it, and side to move */
+};
+
+/* The PGN we are reading. Files are mapped into memory whole. Pipes can't be mapped, so for them */
+/* we keep a window of the input in a buffer and read more as we go. Compressed input (gzip, or zstd */
+/* if the library was built with it) is decompressed into that window too, and offsets are offsets */
+/* in the decompressed PGN */
+struct pgn2fen_input {
+  const char *data; /* The bytes we have at hand */
+  size_t size;
+  size_t pos; /* Next byte to be read. Everything before it may be thrown away */
+  size_t base; /* Offset in the file of data[0] */
+  int fd;
+  int mapped;
+  int eof; /* Nothing more to read, "data" is all there is */
+  int error; /* Why we stopped reading early, PGN2FEN_OK if we didn't */
+  char *buf; /* The window, for pipes and compressed input */
+  size_t cap;
+  void *decoder; /* The thread decompressing the input, if it is compressed */
+  int binary; /* It's a binary database written by pgn2fen_binary_build, not PGN */
+  int variations; /* Variations come as tokens, for pgn2fen_next_variation_move. Set it after opening */
+  int tags; /* Keep the tags of each game in its pgn2fen_game. Set it after opening... */
+  const struct pgn2fen_filter *filter; /* ...and to read past the movetext of the games that don't pass this */
+};
+
+/* The tags of a game we keep, when the input asks for them. Missing ones are empty, or 0 */
+struct pgn2fen_tags {
+  char event[PGN2FEN_TAGSIZE];
+  char site[PGN2FEN_TAGSIZE];
+  char date[16];
+  char round[16];
+  char white[PGN2FEN_TAGSIZE];
+  char black[PGN2FEN_TAGSIZE];
+  char result[8];
+  int whiteelo;
+  int blackelo;
+  char eco[8];
+  char timecontrol[32];
+};
+
+/* Conditions on the tags of a game, like "WhiteElo>=2500 && ECO=B90", put together by pgn2fen_parse_filter */
+struct pgn2fen_condition {
+  int tag; /* Which one */
+  int op; /* PGN2FEN_EQ, PGN2FEN_NE, ... */
+  int or; /* It begins a new group of "&&", after a "||" */
+  int prefix; /* The value ended in "*", any tag beginning like it matches */
+  long number; /* The value, for Elos */
+  char value[PGN2FEN_TAGSIZE];
+};
+
+struct pgn2fen_filter {
+  struct pgn2fen_condition conditions[PGN2FEN_MAXCONDITIONS];
+  int n;
+};
+
+/* A game as we read it. It can be put aside and picked up later, as long as the input stays the same */
+struct pgn2fen_game {
+  struct pgn2fen_position pos;
+  int ply; /* Moves played so far */
+  int started; /* We have seen something of it */
+  int movetext; /* We are past the tags */
+  int over; /* The game ended */
+  size_t offset; /* Where it begins */
+  size_t next; /* Where we stopped reading */
+  pgn2fen_move move; /* The last move played */
+  int left; /* Binary databases: moves of the game we haven't read yet... */
+  int stopped; /* ...and whether it stops at a move that couldn't be played */
+  int filtered; /* Its tags didn't pass the filter of the input, the movetext was read past */
+  struct pgn2fen_tags tags; /* If the input keeps them */
+};
+
+/* Where a variation branches off its parent line. The parent is kept as it was, so when the variation */
+/* ends we carry on from there without replaying anything */
+struct pgn2fen_branch {
+  struct pgn2fen_position pos, prev; /* The parent line, after its last move and before it */
+  pgn2fen_move move;
+  int moved; /* The parent line had a move before the variation */
+  int ply; /* Ply of the move the variation replaces */
+  int number; /* 1 for the first variation replacing that move, 2 for the next one... */
+};
+
+/* The variations we are in while following them with pgn2fen_next_variation_move. Variation stack[0] */
+/* branches off the main line, stack[1] off stack[0], and so on, "depth" of them */
+struct pgn2fen_variations {
+  struct pgn2fen_position prev; /* Before the last move, where a variation beginning now starts from */
+  int moved; /* A move was played in the line we are in */
+  struct pgn2fen_branch stack[PGN2FEN_MAXNESTING];
+  int depth;
+  int closed; /* The number of the variation that just ended, if there were no moves since */
+  int skipping; /* How deep we are in variations we are reading past */
+  int failed; /* The variation we are reading past had a move that can't be played, it ends with them */
+  int errors; /* Variations given up that way */
+};
+
+/* A set of positions, and how many times each one was added. The tables are split in shards, each */
+/* with its lock, and spilled to temporary files in sorted runs when they fill up */
+struct pgn2fen_set {
+  void *shards;
+  size_t slots; /* Most slots a shard can grow to */
+  int shard; /* Reading: the shard we are at... */
+  size_t next; /* ...and the next entry in it */
+};
+
+/* A position searched for in the games, and what a game can't lose on its way there */
+struct pgn2fen_target {
+  struct pgn2fen_position pos;
+  int count[2][6]; /* Pieces of each colour and type */
+  int men[2]; /* All the pieces of each colour */
+  pgn2fen_bitboard home[2]; /* Pawns on their starting squares */
+};
+
+/* Where positions can be found: the key, and the game and ply that reach it */
+struct pgn2fen_indexentry {
+  uint64_t key;
+  uint64_t where; /* Offset of the game in the PGN, shifted 16 bits to the left, and the ply in the low 16 bits */
+};
+
+#define PGN2FEN_INDEX_OFFSET(e) ((size_t) ((e)->where >> 16))
+#define PGN2FEN_INDEX_PLY(e) ((int) ((e)->where & 0xFFFF))
+
+/* An index of every position of a PGN, sorted by key. It's mapped, not read into memory */
+struct pgn2fen_index {
+  const struct pgn2fen_indexentry *entries;
+  size_t count;
+  void *map;
+  size_t mapsize;
+};
+
+/* Where a game is in its PGN, and some of its tags, cut short if they don't fit */
+struct pgn2fen_gameentry {
+  uint64_t offset;
+  uint64_t length;
+  char white[40];
+  char black[40];
+  char date[16];
+  char result[8];
+};
+
+/* The games of a PGN, the first one being games[0]. It's mapped, not read into memory */
+struct pgn2fen_games {
+  const struct pgn2fen_gameentry *games;
+  size_t count;
+  void *map;
+  size_t mapsize;
+};
+
+/* What the library went through, counted when it's built with PGN2FEN_STATS (make STATS=1). */
+/* Otherwise nothing is counted and the hot paths don't pay for it. Each thread counts its own */
+struct pgn2fen_stats {
+  uint64_t bytes; /* Input read, decompressed */
+  uint64_t tokens;
+  uint64_t plies; /* Moves played */
+  uint64_t tagbytes; /* Skipped without a look: tag lines... */
+  uint64_t commentbytes; /* ...and commentaries and variations */
+  uint64_t resolved[6]; /* SAN moves of each piece type whose origin was looked for... */
+  uint64_t candidates[6]; /* ...the pieces that could reach the destination, before disambiguation... */
+  uint64_t disambiguated[6]; /* ...and the moves that gave the origin file or rank */
+  uint64_t castles, enpassant, promotions, doublepushes;
+  double openwall, opencpu; /* Seconds opening inputs... */
+  double readwall, readcpu; /* ...and reading them, or waiting for the decompressor */
+};
+
+/* Positions */
+void pgn2fen_init_position (struct pgn2fen_position *pos);
+int pgn2fen_play (struct pgn2fen_position *pos, const char *move, int len);
+int pgn2fen_play_san (struct pgn2fen_position *pos, const char *move, int len, pgn2fen_move *played);
+int pgn2fen_play_move (struct pgn2fen_position *pos, pgn2fen_move move);
+int pgn2fen_fen (const struct pgn2fen_position *pos, char *buf, size_t size);
+uint64_t pgn2fen_key (const struct pgn2fen_position *pos);
+int pgn2fen_parse_fen (const char *fen, struct pgn2fen_position *pos);
+int pgn2fen_same_position (const struct pgn2fen_position *a, const struct pgn2fen_position *b);
+
+/* Move generation */
+int pgn2fen_legal_moves (const struct pgn2fen_position *pos, pgn2fen_move *moves);
+uint64_t pgn2fen_perft (const struct pgn2fen_position *pos, int depth);
+
+/* Input */
+int pgn2fen_open (const char *path, struct pgn2fen_input *in);
+void pgn2fen_open_memory (const char *data, size_t size, struct pgn2fen_input *in);
+void pgn2fen_close (struct pgn2fen_input *in);
+int pgn2fen_refill (struct pgn2fen_input *in);
+int pgn2fen_read_token (struct pgn2fen_input *in, const char **move, int *len, size_t *start);
+
+/* Games */
+void pgn2fen_init_game (struct pgn2fen_game *g);
+int pgn2fen_next_move (struct pgn2fen_input *in, struct pgn2fen_game *g, int play);
+void pgn2fen_skip_game (struct pgn2fen_input *in, struct pgn2fen_game *g);
+void pgn2fen_init_variations (struct pgn2fen_variations *v);
+int pgn2fen_next_variation_move (struct pgn2fen_input *in, struct pgn2fen_game *g, struct pgn2fen_variations *v);
+size_t pgn2fen_next_game_start (const struct pgn2fen_input *in, size_t from);
+
+/* Position index */
+int pgn2fen_index_build (const char *pgnpath, const char *indexpath);
+int pgn2fen_index_open (const char *indexpath, const char *pgnpath, struct pgn2fen_index *idx);
+size_t pgn2fen_index_find (const struct pgn2fen_index *idx, uint64_t key, const struct pgn2fen_indexentry **first);
+void pgn2fen_index_close (struct pgn2fen_index *idx);
+
+/* Game index */
+int pgn2fen_games_build (const char *pgnpath, const char *indexpath);
+int pgn2fen_games_open (const char *indexpath, const char *pgnpath, struct pgn2fen_games *idx);
+void pgn2fen_games_close (struct pgn2fen_games *idx);
+
+/* Tags */
+int pgn2fen_parse_filter (const char *expr, struct pgn2fen_filter *f);
+int pgn2fen_filter_match (const struct pgn2fen_filter *f, const struct pgn2fen_tags *tags);
+
+/* Searching games for a position */
+void pgn2fen_init_target (struct pgn2fen_target *t, const struct pgn2fen_position *pos);
+int pgn2fen_reachable (const struct pgn2fen_target *t, const struct pgn2fen_position *pos);
+int pgn2fen_search_game (struct pgn2fen_input *in, struct pgn2fen_game *g, const struct pgn2fen_target *t);
+
+/* Sets of positions */
+int pgn2fen_set_open (struct pgn2fen_set *set, size_t budget);
+int pgn2fen_set_add (struct pgn2fen_set *set, const struct pgn2fen_position *pos);
+int pgn2fen_set_finish (struct pgn2fen_set *set);
+int pgn2fen_set_next (struct pgn2fen_set *set, struct pgn2fen_position *pos, uint64_t *count);
+void pgn2fen_set_close (struct pgn2fen_set *set);
+
+/* Binary databases, read with pgn2fen_open like any PGN */
+int pgn2fen_binary_build (const char *pgnpath, const char *binarypath);
+
+/* Statistics */
+int pgn2fen_stats (struct pgn2fen_stats *stats);
+
+const char *pgn2fen_strerror (int error);
+
+#endif
@@ -0,0 +1,841 @@
+/*
+ *  pgn2fen - Extracts FEN of a specific move on a PGN game
+ *  -------------------------------------------------------
+ *  Author: mate_amargo - Juan Alberto Regalado Galván
+ *  https://github.com/mate-amargo/pgn2fen
+ *  -------------------------------------------------------
+ *
+ *  The board: attack tables, playing moves written in SAN, generating the
+ *  legal moves of a position and writing FENs
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+#include "board.h"
+
+/* A move as written in the PGN, taken apart */
+struct san {
+  int piece; /* What moves, PAWN to KING */
+  int castle; /* CASTLEK or CASTLEQ if it's a castling move (for the side to move), 0 otherwise */
+  int fromfile; /* Disambiguation, -1 if not given */
+  int fromrank;
+  int to; /* Destination square */
+  int promotion; /* Piece we promote to, or -1 */
+};
+
+static const char piecechars[2][NPIECES] = { {'p', 'n', 'b', 'r', 'q', 'k'}, {'P', 'N', 'B', 'R', 'Q', 'K'} };
+
+/* Magic numbers for the sliding pieces. Multiplying the relevant occupancy by them maps */
+/* every possible set of blockers to a distinct index of the attack table. Found by trial and error */
+static const bitboard rookmagicnumbers[64] = {
+  0x1080004008801020ULL, 0x0840092002c03000ULL, 0x1900200010400900ULL, 0x0880100008000480ULL,
+  0x4200100420080200ULL, 0x8100020100080400ULL, 0x0200040110886200ULL, 0x0200008040220411ULL,
+  0x0404800084400220ULL, 0x0000401000402000ULL, 0x0086001081220440ULL, 0x0408800800100280ULL,
+  0x000a001201040820ULL, 0x8848800200840080ULL, 0x4001000100040200ULL, 0x0442000102105084ULL,
+  0x9080010020804100ULL, 0x0040404000201009ULL, 0x0000808010002009ULL, 0x2200090021d00100ULL,
+  0x0008008008040080ULL, 0x0004004002010040ULL, 0x0011040008015042ULL, 0x00000a0001768104ULL,
+  0x0000800080204009ULL, 0x2010004140002001ULL, 0x9800200280100080ULL, 0x1000100080080080ULL,
+  0x0442000a00049020ULL, 0x2100040080020080ULL, 0x0800120400900148ULL, 0x0010040a00128541ULL,
+  0x2800804000800030ULL, 0x1010002000400041ULL, 0x4000200011004100ULL, 0x0610008410800800ULL,
+  0x0400802402800800ULL, 0xc100020080800400ULL, 0x0002000802000401ULL, 0x0182085882000401ULL,
+  0x0220204000808000ULL, 0x2860100040024022ULL, 0x0001002004110040ULL, 0x99101042000a0020ULL,
+  0x0004080004008080ULL, 0x0010040002008080ULL, 0x2012004881020004ULL, 0x8300842444820011ULL,
+  0x0088403882010200ULL, 0x0820400080210100ULL, 0x0110910040a00300ULL, 0x0801100280080480ULL,
+  0x0242009008200600ULL, 0x1002000489500200ULL, 0x0040800200010080ULL, 0x0091800041000080ULL,
+  0x0000209300488001ULL, 0x04c1002414824001ULL, 0x020020000b001041ULL, 0x7000100004200901ULL,
+  0x8002002004100802ULL, 0x30010002084c0007ULL, 0x0888221800813004ULL, 0x4000002840840112ULL
+};
+
+static const bitboard bishopmagicnumbers[64] = {
+  0xa010041108003100ULL, 0x006082020a002900ULL, 0x6810010619200000ULL, 0x08281a0520000408ULL,
+  0x0001104001000400ULL, 0x0018901008048400ULL, 0x00040a0210245280ULL, 0x000200210808a402ULL,
+  0x9140048410821200ULL, 0x0800091010820041ULL, 0x20504804832202c0ULL, 0x0100091401081000ULL,
+  0x8021011140000012ULL, 0x0810020804450400ULL, 0x208b0542109008a2ULL, 0x0080084a08040204ULL,
+  0x0040e2a80811244cULL, 0x2505022008008108ULL, 0x0430220100420040ULL, 0x010a040420220040ULL,
+  0x1105000290400000ULL, 0x0093001200822120ULL, 0x4000a62048043004ULL, 0x280120048a015004ULL,
+  0x006090002a020814ULL, 0x44042000240800d0ULL, 0x01102800040a4400ULL, 0x1004080080220040ULL,
+  0x0001001011004024ULL, 0x0010044000805040ULL, 0x0914041200820100ULL, 0x0004821012821480ULL,
+  0x0024040500c05021ULL, 0x0088611002080200ULL, 0x0116080a00040020ULL, 0x4000020080080080ULL,
+  0x2450450140840040ULL, 0x0000880201484100ULL, 0x0222020404020092ULL, 0x8081110600002e00ULL,
+  0x2842101105000801ULL, 0x1100809008001025ULL, 0x00020202221c0400ULL, 0x0422014022009020ULL,
+  0x0210046102100c00ULL, 0xc004008082029102ULL, 0x00aa461801101200ULL, 0x0404080080201108ULL,
+  0x020542108c205002ULL, 0x0410544804100100ULL, 0x0040910841100000ULL, 0x0400200042021100ULL,
+  0x00004204850400c0ULL, 0x0200100410a42102ULL, 0x1040020801210102ULL, 0x0805040410420000ULL,
+  0x2884804130100200ULL, 0x800c262201242000ULL, 0x1058000194108800ULL, 0x0014221054420204ULL,
+  0x0104000012a02200ULL, 0x0200881003300100ULL, 0x0140400202840100ULL, 0x0402020801010201ULL
+};
+
+struct magic {
+  bitboard mask; /* Squares whose occupancy matters: the rays, without the edge of the board */
+  bitboard magic;
+  bitboard *attacks; /* This square's slice of the attack table */
+  int shift;
+};
+
+/* Precomputed attacks, filled once by init_attacks(). The tables don't change afterwards, so threads can share them */
+static bitboard knightattacks[RANKS*FILES], kingattacks[RANKS*FILES], pawnattacks[2][RANKS*FILES];
+static bitboard between[RANKS*FILES][RANKS*FILES]; /* Squares strictly between two on the same line, if they are... */
+static bitboard line[RANKS*FILES][RANKS*FILES];    /* ...and the whole line through them, edge to edge */
+static struct magic rookmagics[RANKS*FILES], bishopmagics[RANKS*FILES];
+static bitboard rooktable[0x19000], bishoptable[0x1480]; /* Each square needs 2^(bits in the mask) entries */
+
+/* Walk the rays from "sq" until we hit a piece (included) or the edge of the board */
+static bitboard slider_attacks (int sq, bitboard occupied, const int (*dirs)[2]) {
+  bitboard attacks = 0;
+  int i, f, r;
+  for (i = 0; i < 4; i++)
+    for (f = FILEOF(sq) + dirs[i][0], r = RANKOF(sq) + dirs[i][1]; f >= 0 && f < FILES && r >= 0 && r < RANKS;
+         f += dirs[i][0], r += dirs[i][1]) {
+      attacks |= BIT(SQUARE(f, r));
+      if (occupied & BIT(SQUARE(f, r))) /* We hit a piece */
+        break;
+    }
+  return attacks;
+}
+
+static const int rookdirs[4][2] = { {1, 0}, {-1, 0}, {0, 1}, {0, -1} };
+static const int bishopdirs[4][2] = { {1, 1}, {1, -1}, {-1, 1}, {-1, -1} };
+
+/* Where the attacks for this set of blockers are. With BMI2 we let the CPU pack the blockers for us */
+static inline unsigned magic_index (const struct magic *m, bitboard occupied) {
+#ifdef __BMI2__
+  return _pext_u64(occupied, m->mask);
+#else
+  return ((occupied & m->mask) * m->magic) >> m->shift;
+#endif
+}
+
+static void init_magics (struct magic *magics, const bitboard *numbers, bitboard *table, const int (*dirs)[2]) {
+  bitboard edges, blockers;
+  int sq;
+  for (sq = 0; sq < RANKS*FILES; sq++) {
+    /* The edges only matter if we are on them */
+    edges = ((RANK1 | RANK8) & ~(RANK1 << (8 * RANKOF(sq)))) | ((FILEA | FILEH) & ~(FILEA << FILEOF(sq)));
+    magics[sq].mask = slider_attacks(sq, 0, dirs) & ~edges;
+    magics[sq].magic = numbers[sq];
+    magics[sq].shift = 64 - __builtin_popcountll(magics[sq].mask);
+    magics[sq].attacks = table;
+    blockers = 0;
+    do { /* Every subset of the mask */
+      magics[sq].attacks[magic_index(&magics[sq], blockers)] = slider_attacks(sq, blockers, dirs);
+      blockers = (blockers - magics[sq].mask) & magics[sq].mask;
+    } while (blockers);
+    table += (bitboard) 1 << (64 - magics[sq].shift);
+  }
+}
+
+static void init_attacks (void) {
+  const int (*dirs)[2];
+  bitboard b;
+  int sq, to;
+  for (sq = 0; sq < RANKS*FILES; sq++) {
+    b = BIT(sq); /* The masks stop us from wrapping around the board */
+    knightattacks[sq] = (((b << 17) | (b >> 15)) & ~FILEA) | (((b << 15) | (b >> 17)) & ~FILEH) |
+                        (((b << 10) | (b >> 6)) & ~(FILEA | FILEB)) | (((b << 6) | (b >> 10)) & ~(FILEG | FILEH));
+    kingattacks[sq] = (((b << 1) | (b << 9) | (b >> 7)) & ~FILEA) | (((b >> 1) | (b >> 9) | (b << 7)) & ~FILEH) |
+                      (b << 8) | (b >> 8);
+    pawnattacks[WHITE][sq] = ((b << 9) & ~FILEA) | ((b << 7) & ~FILEH);
+    pawnattacks[BLACK][sq] = ((b >> 7) & ~FILEA) | ((b >> 9) & ~FILEH);
+  }
+  for (sq = 0; sq < RANKS*FILES; sq++)
+    for (to = 0; to < RANKS*FILES; to++) {
+      if (slider_attacks(sq, 0, rookdirs) & BIT(to))
+        dirs = rookdirs;
+      else if (slider_attacks(sq, 0, bishopdirs) & BIT(to))
+        dirs = bishopdirs;
+      else
+        continue;
+      between[sq][to] = slider_attacks(sq, BIT(to), dirs) & slider_attacks(to, BIT(sq), dirs);
+      line[sq][to] = (slider_attacks(sq, 0, dirs) & slider_attacks(to, 0, dirs)) | BIT(sq) | BIT(to);
+    }
+  init_magics(rookmagics, rookmagicnumbers, rooktable, rookdirs);
+  init_magics(bishopmagics, bishopmagicnumbers, bishoptable, bishopdirs);
+}
+
+/* Zobrist keys: a random number for every piece of each colour on every square, for the castling rights, */
+/* the file of the enpassant square (only if a pawn can take on it) and the side to move. The key of a position is the XOR of the ones that */
+/* apply, so it can be kept up to date as the pieces move. They come from a fixed seed, so keys are the same */
+/* from one run to the next and can be compared across databases */
+static uint64_t piecekeys[2][NPIECES][RANKS*FILES], castlingkeys[16], enpassantkeys[FILES], blackkey;
+
+/* splitmix64, good enough to fill the Zobrist tables */
+static uint64_t next_random (uint64_t *state) {
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+static void init_keys (void) {
+  uint64_t state = 0x70676e3266656eULL; /* "pgn2fen" */
+  int colour, piece, i;
+  for (colour = BLACK; colour <= WHITE; colour++)
+    for (piece = PAWN; piece < NPIECES; piece++)
+      for (i = 0; i < RANKS*FILES; i++)
+        piecekeys[colour][piece][i] = next_random(&state);
+  castlingkeys[0] = 0; /* The rights are a bitmask, each one gets its own key and a set of them is their XOR */
+  castlingkeys[CASTLEK] = next_random(&state);
+  castlingkeys[CASTLEQ] = next_random(&state);
+  castlingkeys[CASTLEk] = next_random(&state);
+  castlingkeys[CASTLEq] = next_random(&state);
+  for (i = 1; i < 16; i++)
+    castlingkeys[i] = castlingkeys[i & CASTLEK] ^ castlingkeys[i & CASTLEQ] ^ castlingkeys[i & CASTLEk] ^ castlingkeys[i & CASTLEq];
+  for (i = 0; i < FILES; i++)
+    enpassantkeys[i] = next_random(&state);
+  blackkey = next_random(&state);
+}
+
+/* What each rank looks like in a FEN, for every set of occupied squares: the runs of empty squares as */
+/* digits and a "*" for each piece, like "2*4*" for pieces on c and h. The pieces are filled in as we go */
+static char rankfen[256][FILES];
+static unsigned char rankfenlen[256];
+
+static void init_rankfen (void) {
+  int occupied, file, empty, n;
+  for (occupied = 0; occupied < 256; occupied++) {
+    for (file = empty = n = 0; file < FILES; file++)
+      if (occupied & (1 << file)) {
+        if (empty)
+          rankfen[occupied][n++] = '0' + empty;
+        rankfen[occupied][n++] = '*';
+        empty = 0;
+      } else
+        empty++;
+    if (empty)
+      rankfen[occupied][n++] = '0' + empty;
+    rankfenlen[occupied] = n;
+  }
+}
+
+static void init_tables (void) {
+  init_attacks();
+  init_keys();
+  init_rankfen();
+}
+
+static pthread_once_t tablesonce = PTHREAD_ONCE_INIT;
+
+static inline bitboard rook_attacks (int sq, bitboard occupied) {
+  return rookmagics[sq].attacks[magic_index(&rookmagics[sq], occupied)];
+}
+
+static inline bitboard bishop_attacks (int sq, bitboard occupied) {
+  return bishopmagics[sq].attacks[magic_index(&bishopmagics[sq], occupied)];
+}
+
+/* Squares from which a "piece" could reach "sq". It's symmetric, so it's the same as the squares "piece" attacks from "sq" */
+static bitboard attacks_from (int piece, int sq, bitboard occupied) {
+  switch (piece) {
+    case KNIGHT:
+      return knightattacks[sq];
+    case BISHOP:
+      return bishop_attacks(sq, occupied);
+    case ROOK:
+      return rook_attacks(sq, occupied);
+    case QUEEN:
+      return bishop_attacks(sq, occupied) | rook_attacks(sq, occupied);
+    case KING:
+      return kingattacks[sq];
+  }
+  return 0;
+}
+
+/* Pieces of both colours attacking "sq", with "occupied" blocking the sliding pieces */
+static bitboard attackers_to (const struct pgn2fen_position *pos, int sq, bitboard occupied) {
+  return (pawnattacks[BLACK][sq] & pos->pieces[PAWN] & pos->colour[WHITE]) |
+         (pawnattacks[WHITE][sq] & pos->pieces[PAWN] & pos->colour[BLACK]) |
+         (knightattacks[sq] & pos->pieces[KNIGHT]) | (kingattacks[sq] & pos->pieces[KING]) |
+         (bishop_attacks(sq, occupied) & (pos->pieces[BISHOP] | pos->pieces[QUEEN])) |
+         (rook_attacks(sq, occupied) & (pos->pieces[ROOK] | pos->pieces[QUEEN]));
+}
+
+/* The position before the first move. It's the first thing anybody needs, so the tables get filled here */
+void pgn2fen_init_position (struct pgn2fen_position *pos) {
+  pthread_once(&tablesonce, init_tables);
+  memset(pos, 0, sizeof(*pos));
+  pos->pieces[PAWN] = RANK2 | RANK7;
+  pos->pieces[KNIGHT] = BIT(SQUARE(1, 0)) | BIT(SQUARE(6, 0)) | BIT(SQUARE(1, 7)) | BIT(SQUARE(6, 7));
+  pos->pieces[BISHOP] = BIT(SQUARE(2, 0)) | BIT(SQUARE(5, 0)) | BIT(SQUARE(2, 7)) | BIT(SQUARE(5, 7));
+  pos->pieces[ROOK] = BIT(SQUARE(0, 0)) | BIT(SQUARE(7, 0)) | BIT(SQUARE(0, 7)) | BIT(SQUARE(7, 7));
+  pos->pieces[QUEEN] = BIT(SQUARE(3, 0)) | BIT(SQUARE(3, 7));
+  pos->pieces[KING] = BIT(SQUARE(4, 0)) | BIT(SQUARE(4, 7));
+  pos->colour[WHITE] = RANK1 | RANK2;
+  pos->colour[BLACK] = RANK7 | RANK8;
+  pos->occupied = pos->colour[WHITE] | pos->colour[BLACK];
+  pos->castling = CASTLEK | CASTLEQ | CASTLEk | CASTLEq;
+  pos->turn = WHITE;
+  pos->enpassant = NOSQUARE;
+  pos->fullmove = 1;
+  pos->key = pgn2fen_key(pos);
+}
+
+/* What's on "sq", -1 if it's empty */
+static int piece_on (const struct pgn2fen_position *pos, int sq) {
+  int piece;
+  if (!(pos->occupied & BIT(sq)))
+    return -1;
+  for (piece = PAWN; !(pos->pieces[piece] & BIT(sq)); piece++);
+  return piece;
+}
+
+/* Take apart a move like "Nbxd7", "exd8=Q" or "O-O-O". Returns PGN2FEN_ESAN if it doesn't make sense */
+static int parse_san (const char *move, int len, struct san *san) {
+
+  int files[2], ranks[2], nfiles = 0, nranks = 0, i = 0;
+
+  san->castle = 0;
+  san->promotion = -1;
+  if ('O' == move[0]) { /* Castling, "O-O" or "O-O-O" */
+    san->piece = KING;
+    san->castle = (len >= 5)?CASTLEQ:CASTLEK;
+    san->to = NOSQUARE;
+    san->fromfile = san->fromrank = -1;
+    return 0;
+  }
+  switch (move[0]) {
+    case 'N': san->piece = KNIGHT; i++; break;
+    case 'B': san->piece = BISHOP; i++; break;
+    case 'R': san->piece = ROOK; i++; break;
+    case 'Q': san->piece = QUEEN; i++; break;
+    case 'K': san->piece = KING; i++; break;
+    default: san->piece = PAWN;
+  }
+  for (; i < len; i++)
+    if (move[i] >= 'a' && move[i] <= 'h' && nfiles < 2)
+      files[nfiles++] = move[i] - 'a';
+    else if (move[i] >= '1' && move[i] <= '8' && nranks < 2)
+      ranks[nranks++] = move[i] - '1';
+    else if (strchr("NBRQ", move[i]) && PAWN == san->piece) /* Promotion, with or without "=" */
+      san->promotion = strchr(" NBRQ", move[i]) - " NBRQ";
+  if (!nfiles || !nranks)
+    return PGN2FEN_ESAN;
+  /* The destination is always the last square, whatever comes before it is the origin */
+  san->to = SQUARE(files[nfiles-1], ranks[nranks-1]);
+  san->fromfile = (2 == nfiles)?files[0]:-1;
+  san->fromrank = (2 == nranks)?ranks[0]:-1;
+  return 0;
+}
+
+/* Castling rights lost when something moves from or to "sq" */
+static int castling_lost (int sq) {
+  switch (sq) {
+    case SQUARE(4, 0): return CASTLEK | CASTLEQ; /* White king */
+    case SQUARE(7, 0): return CASTLEK;
+    case SQUARE(0, 0): return CASTLEQ;
+    case SQUARE(4, 7): return CASTLEk | CASTLEq; /* Black king */
+    case SQUARE(7, 7): return CASTLEk;
+    case SQUARE(0, 7): return CASTLEq;
+  }
+  return 0;
+}
+
+/* Take whatever is on "sq" off the board */
+static void remove_piece (struct pgn2fen_position *pos, int piece, int colour, int sq) {
+  pos->pieces[piece] &= ~BIT(sq);
+  pos->colour[colour] &= ~BIT(sq);
+  pos->occupied &= ~BIT(sq);
+  pos->key ^= piecekeys[colour][piece][sq];
+}
+
+/* Move "piece" of the side to move from "from" to "to", whatever was on "to" is captured */
+static void move_piece (struct pgn2fen_position *pos, int piece, int from, int to) {
+  int captured = piece_on(pos, to);
+  if (captured >= 0)
+    remove_piece(pos, captured, !pos->turn, to);
+  pos->pieces[piece] ^= BIT(from) | BIT(to);
+  pos->colour[pos->turn] ^= BIT(from) | BIT(to);
+  pos->occupied = pos->colour[WHITE] | pos->colour[BLACK];
+  pos->key ^= piecekeys[pos->turn][piece][from] ^ piecekeys[pos->turn][piece][to];
+}
+
+/* The enpassant square, if a pawn of the side to move stands next to the pawn that went past it and can */
+/* take it. NOSQUARE otherwise: the square makes no difference then, so it isn't part of the key, and */
+/* positions that only differ in it are the same position whatever move order led to them */
+int pgn2fen_enpassant (const struct pgn2fen_position *pos) {
+  if (pos->enpassant != NOSQUARE && (pawnattacks[!pos->turn][pos->enpassant] & pos->pieces[PAWN] & pos->colour[pos->turn]))
+    return pos->enpassant;
+  return NOSQUARE;
+}
+
+/* Whether the side to move is in check */
+int pgn2fen_in_check (const struct pgn2fen_position *pos) {
+  bitboard king = pos->pieces[KING] & pos->colour[pos->turn];
+  pthread_once(&tablesonce, init_tables);
+  return king && (attackers_to(pos, LSB(king), pos->occupied) & pos->colour[!pos->turn]);
+}
+
+/* Make a move we know the origin of: "piece" of the side to move goes from "from" to "to", and becomes */
+/* "promotion" if it's not -1. A king moving two squares is castling, the rook jumps over it */
+static void make_move (struct pgn2fen_position *pos, int piece, int from, int to, int promotion) {
+
+  int forward = (pos->turn)?8:-8;
+  int capture = (pos->occupied & BIT(to)) != 0;
+  int castling = pos->castling;
+  int enpassant = pgn2fen_enpassant(pos); /* Before anything moves, the way it was when it went into the key */
+
+  if (enpassant != NOSQUARE)
+    pos->key ^= enpassantkeys[FILEOF(enpassant)];
+  if (KING == piece && abs(to - from) == 2) {
+    move_piece(pos, KING, from, to);
+    if (to > from)
+      move_piece(pos, ROOK, to + 1, to - 1);
+    else
+      move_piece(pos, ROOK, to - 2, to + 1);
+  } else {
+    if (PAWN == piece && to == pos->enpassant && FILEOF(from) != FILEOF(to)) { /* Clear the passed pawn, it's beside us */
+      remove_piece(pos, PAWN, !pos->turn, to - forward);
+      capture = 1;
+    }
+    move_piece(pos, piece, from, to);
+    if (promotion >= 0) {
+      pos->pieces[PAWN] &= ~BIT(to);
+      pos->pieces[promotion] |= BIT(to);
+      pos->key ^= piecekeys[pos->turn][PAWN][to] ^ piecekeys[pos->turn][promotion][to];
+    }
+  }
+
+  pos->castling &= ~(castling_lost(from) | castling_lost(to)); /* Moving the king or a rook, or capturing a rook */
+  pos->enpassant = (PAWN == piece && abs(to - from) == 16)?(from + to)/2:NOSQUARE;
+  pos->ply = (PAWN == piece || capture)?0:pos->ply+1; /* Pawn move or capture resets the halfmove clock */
+  if (!pos->turn)
+    pos->fullmove++; /* Incremented after Black's move */
+  pos->turn = (pos->turn)?BLACK:WHITE; /* Toggle turn */
+  pos->key ^= castlingkeys[castling] ^ castlingkeys[pos->castling] ^ blackkey;
+  if ((enpassant = pgn2fen_enpassant(pos)) != NOSQUARE) /* Only if the other side can take it */
+    pos->key ^= enpassantkeys[FILEOF(enpassant)];
+}
+
+/* Which of the pieces of the side to move on "from" can go to "to" without leaving their king in check. */
+/* Only the ones that are pinned, or don't deal with a check, are left out */
+static bitboard legal_origins (const struct pgn2fen_position *pos, bitboard from, int to) {
+  bitboard mine = pos->colour[pos->turn], king = pos->pieces[KING] & mine, legal = 0;
+  int sq;
+  if (!king)
+    return from;
+  for (; from; from &= from - 1) {
+    sq = LSB(from);
+    if (!(attackers_to(pos, LSB(king), (pos->occupied ^ BIT(sq)) | BIT(to)) & ~mine & ~BIT(to)))
+      legal |= BIT(sq);
+  }
+  return legal;
+}
+
+/* Whether the side to move can castle "side" (CASTLEK or CASTLEQ, whatever its colour): it still has the */
+/* right, the king and the rook are where they start, nothing stands between them, and the king isn't in */
+/* check and doesn't go through or into one */
+static int can_castle (const struct pgn2fen_position *pos, int side) {
+  bitboard mine = pos->colour[pos->turn];
+  int home = (pos->turn)?0:RANKS-1, king = SQUARE(4, home), sq;
+  int rook = (CASTLEK == side)?SQUARE(7, home):SQUARE(0, home), to = (CASTLEK == side)?SQUARE(6, home):SQUARE(2, home);
+  if (!(pos->castling & ((pos->turn)?side:side >> 2)) || !(pos->pieces[KING] & mine & BIT(king)) ||
+      !(pos->pieces[ROOK] & mine & BIT(rook)) || (between[king][rook] & pos->occupied))
+    return 0;
+  for (sq = king; ; sq += (to > king)?1:-1) {
+    if (attackers_to(pos, sq, pos->occupied) & ~mine)
+      return 0;
+    if (sq == to)
+      return 1;
+  }
+}
+
+/* Find out where the piece of a SAN move comes from and play it. "played" gets the move, coded, if it's */
+/* not NULL. Returns PGN2FEN_EILLEGAL if no piece can make it */
+static int apply_move (struct pgn2fen_position *pos, const struct san *san, pgn2fen_move *played) {
+
+  bitboard mine = pos->colour[pos->turn], candidates;
+  int from, to = san->to, back = (pos->turn)?1:RANKS-2, home = (pos->turn)?0:RANKS-1;
+  int forward = (pos->turn)?8:-8;
+
+  if (!san->castle && (mine & BIT(to))) /* We can't take our own pieces */
+    return PGN2FEN_EILLEGAL;
+
+  if (san->castle) { /* The king goes two squares towards the rook */
+    if (!can_castle(pos, san->castle))
+      return PGN2FEN_EILLEGAL;
+    from = SQUARE(4, home);
+    to = (CASTLEK == san->castle)?SQUARE(6, home):SQUARE(2, home);
+    STAT(castles, 1);
+  } else if (PAWN == san->piece) {
+    if (RANKOF(to) == home || RANKOF(to) == back) /* No pawn gets there, and the origin would be off the board */
+      return PGN2FEN_EILLEGAL;
+    if ((RANKOF(to) == RANKS-1 - home) != (san->promotion >= 0)) /* It promotes on the last rank, and only there */
+      return PGN2FEN_EILLEGAL;
+    if (san->fromfile >= 0 && san->fromfile != FILEOF(to)) { /* Capture */
+      if (abs(san->fromfile - FILEOF(to)) != 1 || !((pos->colour[!pos->turn] & BIT(to)) || to == pos->enpassant))
+        return PGN2FEN_EILLEGAL;
+      from = SQUARE(san->fromfile, RANKOF(to)) - forward;
+      STAT(enpassant, (to == pos->enpassant));
+    } else if (pos->occupied & BIT(to)) /* Pawns only take sideways */
+      return PGN2FEN_EILLEGAL;
+    else if (!(pos->occupied & BIT(to - forward)) && RANKOF(to - 2*forward) == back) {
+      from = to - 2*forward; /* Double push from our first rank */
+      STAT(doublepushes, 1);
+    } else
+      from = to - forward;
+    if (!(pos->pieces[PAWN] & mine & BIT(from)))
+      return PGN2FEN_EILLEGAL;
+    STAT(resolved[PAWN], 1);
+    STAT(candidates[PAWN], 1);
+    STAT(promotions, (san->promotion >= 0));
+  } else {
+    /* The piece has to be somewhere it can reach the destination from */
+    candidates = attacks_from(san->piece, to, pos->occupied) & pos->pieces[san->piece] & mine;
+    STAT(resolved[san->piece], 1);
+    STAT(candidates[san->piece], __builtin_popcountll(candidates));
+    STAT(disambiguated[san->piece], (san->fromfile >= 0 || san->fromrank >= 0));
+    if (san->fromfile >= 0)
+      candidates &= FILEA << san->fromfile;
+    if (san->fromrank >= 0)
+      candidates &= RANK1 << (8 * san->fromrank);
+    if (candidates & (candidates - 1)) /* The SAN says it's enough, so some of them must be pinned */
+      candidates = legal_origins(pos, candidates, to);
+    if (!candidates)
+      return PGN2FEN_EILLEGAL;
+    from = LSB(candidates);
+  }
+
+  make_move(pos, san->piece, from, to, san->promotion);
+  if (played)
+    *played = PGN2FEN_MOVE(from, to, (san->promotion >= 0)?san->promotion:0);
+  return 0;
+}
+
+/* The Zobrist key of the position, worked out from scratch. Moves keep pos->key up to date, so this is only */
+/* needed for positions set up by hand. The clocks are left out: the same position a few moves later has the same key */
+uint64_t pgn2fen_key (const struct pgn2fen_position *pos) {
+  uint64_t key;
+  bitboard b;
+  int piece, sq;
+  pthread_once(&tablesonce, init_tables); /* Before any table is read, this may be the first call */
+  key = castlingkeys[pos->castling & 15];
+  for (piece = PAWN; piece < NPIECES; piece++)
+    for (b = pos->pieces[piece]; b; b &= b - 1) {
+      sq = LSB(b);
+      key ^= piecekeys[(pos->colour[WHITE] & BIT(sq)) != 0][piece][sq];
+    }
+  if (pgn2fen_enpassant(pos) != NOSQUARE)
+    key ^= enpassantkeys[FILEOF(pos->enpassant)];
+  if (!pos->turn)
+    key ^= blackkey;
+  return key;
+}
+
+
+/* Play a move like "Nbxd7" on the board. "len" is the length of "move", which doesn't need to end in '\0' */
+int pgn2fen_play (struct pgn2fen_position *pos, const char *move, int len) {
+  return pgn2fen_play_san(pos, move, len, NULL);
+}
+
+/* Same as pgn2fen_play, and "played" gets the move coded, unless it's NULL */
+int pgn2fen_play_san (struct pgn2fen_position *pos, const char *move, int len, pgn2fen_move *played) {
+  struct san san;
+  int error;
+  if (len <= 0)
+    return PGN2FEN_ESAN;
+  if ((error = parse_san(move, len, &san)) < 0)
+    return error;
+  return apply_move(pos, &san, played);
+}
+
+/* Play a coded move, as it comes from pgn2fen_game.move or a binary database. There's nothing to work out, */
+/* only what's on the origin square is checked. Returns PGN2FEN_EILLEGAL if the move can't be right */
+int pgn2fen_play_move (struct pgn2fen_position *pos, pgn2fen_move move) {
+  int from = PGN2FEN_MOVE_FROM(move), to = PGN2FEN_MOVE_TO(move), promotion = PGN2FEN_MOVE_PROMOTION(move);
+  int piece = piece_on(pos, from);
+  if (piece < 0 || !(pos->colour[pos->turn] & BIT(from)) || (pos->colour[pos->turn] & BIT(to)) ||
+      (promotion && PAWN != piece) || promotion > QUEEN ||
+      (PAWN == piece && (0 == RANKOF(to) || RANKS-1 == RANKOF(to)) != (promotion != 0)))
+    return PGN2FEN_EILLEGAL;
+  make_move(pos, piece, from, to, (promotion)?promotion:-1);
+  return 0;
+}
+
+/* Add a move from "from" to each of "targets". Pawns reaching the last rank add one for each promotion */
+static int add_moves (pgn2fen_move *moves, int n, int from, bitboard targets, int promotes) {
+  int to, promotion;
+  for (; targets; targets &= targets - 1) {
+    to = LSB(targets);
+    if (promotes)
+      for (promotion = QUEEN; promotion >= KNIGHT; promotion--)
+        moves[n++] = PGN2FEN_MOVE(from, to, promotion);
+    else
+      moves[n++] = PGN2FEN_MOVE(from, to, 0);
+  }
+  return n;
+}
+
+/* Write the legal moves of the position to "moves", which must have room for PGN2FEN_MAXMOVES. Returns */
+/* how many there are, 0 if it's mate or stalemate. The pieces the king is pinned to may only move along the pin, */
+/* and in check only the moves that take the checker or get in its way are left, or none but the king's in double check */
+int pgn2fen_legal_moves (const struct pgn2fen_position *pos, pgn2fen_move *moves) {
+
+  bitboard mine = pos->colour[pos->turn], theirs = pos->colour[!pos->turn], occupied = pos->occupied;
+  bitboard pawns = pos->pieces[PAWN] & mine, last = (pos->turn)?RANK8:RANK1;
+  bitboard checkers, pinned = 0, target, snipers, b, targets, occupiedafter;
+  int forward = (pos->turn)?8:-8, home = (pos->turn)?0:RANKS-1;
+  int king, from, to, piece, n = 0;
+
+  pthread_once(&tablesonce, init_tables);
+  if (!(pos->pieces[KING] & mine))
+    return 0;
+  king = LSB(pos->pieces[KING] & mine);
+  checkers = attackers_to(pos, king, occupied) & theirs;
+
+  /* The king, to squares nobody attacks. It's taken off the board first so it can't hide behind itself */
+  for (b = kingattacks[king] & ~mine; b; b &= b - 1)
+    if (!(attackers_to(pos, LSB(b), occupied ^ BIT(king)) & theirs))
+      moves[n++] = PGN2FEN_MOVE(king, LSB(b), 0);
+  if (checkers & (checkers - 1)) /* Double check, only the king can do something about it */
+    return n;
+  target = (checkers)?checkers | between[king][LSB(checkers)]:~mine;
+
+  /* The pinned pieces: the only piece between the king and one of their sliders looking at it through */
+  /* the others, which is ours */
+  snipers = (rook_attacks(king, theirs) & (pos->pieces[ROOK] | pos->pieces[QUEEN]) & theirs) |
+            (bishop_attacks(king, theirs) & (pos->pieces[BISHOP] | pos->pieces[QUEEN]) & theirs);
+  for (; snipers; snipers &= snipers - 1) {
+    b = between[king][LSB(snipers)] & occupied;
+    if (b && !(b & (b - 1)) && (b & mine))
+      pinned |= b;
+  }
+
+  for (piece = KNIGHT; piece <= QUEEN; piece++)
+    for (b = pos->pieces[piece] & mine; b; b &= b - 1) {
+      from = LSB(b);
+      targets = attacks_from(piece, from, occupied) & target;
+      if (pinned & BIT(from))
+        targets &= line[king][from];
+      n = add_moves(moves, n, from, targets, 0);
+    }
+
+  for (b = pawns; b; b &= b - 1) {
+    from = LSB(b);
+    targets = pawnattacks[pos->turn][from] & theirs;
+    if (!(occupied & BIT(from + forward))) {
+      targets |= BIT(from + forward);
+      if (RANKOF(from - forward) == home && !(occupied & BIT(from + 2*forward)))
+        targets |= BIT(from + 2*forward);
+    }
+    targets &= target;
+    if (pinned & BIT(from))
+      targets &= line[king][from];
+    n = add_moves(moves, n, from, targets & ~last, 0);
+    n = add_moves(moves, n, from, targets & last, 1);
+  }
+
+  /* En passant takes two pawns off a rank at once, so the pins don't tell. We look at the board after it */
+  if (pos->enpassant != NOSQUARE)
+    for (b = pawnattacks[!pos->turn][pos->enpassant] & pawns; b; b &= b - 1) {
+      from = LSB(b);
+      to = pos->enpassant;
+      occupiedafter = (occupied ^ BIT(from) ^ BIT(to - forward)) | BIT(to);
+      if (!(attackers_to(pos, king, occupiedafter) & theirs & ~BIT(to - forward)))
+        moves[n++] = PGN2FEN_MOVE(from, to, 0);
+    }
+
+  /* Castling: the rook is there, nothing stands between them, and the king isn't in check and doesn't */
+  /* go through or land on an attacked square */
+  if (!checkers && king == SQUARE(4, home)) {
+    if ((pos->castling & ((pos->turn)?CASTLEK:CASTLEk)) && (pos->pieces[ROOK] & mine & BIT(SQUARE(7, home))) &&
+        !(occupied & (BIT(SQUARE(5, home)) | BIT(SQUARE(6, home)))) &&
+        !(attackers_to(pos, SQUARE(5, home), occupied) & theirs) && !(attackers_to(pos, SQUARE(6, home), occupied) & theirs))
+      moves[n++] = PGN2FEN_MOVE(king, SQUARE(6, home), 0);
+    if ((pos->castling & ((pos->turn)?CASTLEQ:CASTLEq)) && (pos->pieces[ROOK] & mine & BIT(SQUARE(0, home))) &&
+        !(occupied & (BIT(SQUARE(1, home)) | BIT(SQUARE(2, home)) | BIT(SQUARE(3, home)))) &&
+        !(attackers_to(pos, SQUARE(3, home), occupied) & theirs) && !(attackers_to(pos, SQUARE(2, home), occupied) & theirs))
+      moves[n++] = PGN2FEN_MOVE(king, SQUARE(2, home), 0);
+  }
+  return n;
+}
+
+/* How many move sequences "depth" plies long can be played from the position. The numbers are known */
+/* for many positions, so they tell if the move generator and the move maker are right */
+uint64_t pgn2fen_perft (const struct pgn2fen_position *pos, int depth) {
+  pgn2fen_move moves[PGN2FEN_MAXMOVES];
+  struct pgn2fen_position next;
+  uint64_t nodes = 0;
+  int n, i, promotion;
+  if (depth <= 0)
+    return 1;
+  n = pgn2fen_legal_moves(pos, moves);
+  if (1 == depth) /* No need to play them */
+    return n;
+  for (i = 0; i < n; i++) {
+    next = *pos;
+    promotion = PGN2FEN_MOVE_PROMOTION(moves[i]);
+    make_move(&next, piece_on(pos, PGN2FEN_MOVE_FROM(moves[i])), PGN2FEN_MOVE_FROM(moves[i]), PGN2FEN_MOVE_TO(moves[i]),
+              (promotion)?promotion:-1);
+    nodes += pgn2fen_perft(&next, depth - 1);
+  }
+  return nodes;
+}
+
+/* Write "n" in decimal at "p". Returns where it ends */
+static char *write_number (char *p, unsigned n) {
+  char digits[10];
+  int i = 0;
+  do {
+    digits[i++] = '0' + n % 10;
+  } while (n /= 10);
+  while (i)
+    *p++ = digits[--i];
+  return p;
+}
+
+/* Write the FEN of the position to "buf", ended by '\0'. PGN2FEN_FENSIZE bytes are always enough. */
+/* Returns the length of the FEN, or PGN2FEN_ENOSPACE if it doesn't fit */
+int pgn2fen_fen (const struct pgn2fen_position *pos, char *buf, size_t size) {
+
+  char tmp[PGN2FEN_FENSIZE], *fen = (size >= PGN2FEN_FENSIZE)?buf:tmp, *p = fen;
+  char board[RANKS*FILES]; /* The letter of the piece on each occupied square */
+  const char *template;
+  bitboard b;
+  int rank, colour, piece, occupied, i, n;
+
+  pthread_once(&tablesonce, init_tables);
+  for (colour = BLACK; colour <= WHITE; colour++)
+    for (piece = PAWN; piece < NPIECES; piece++)
+      for (b = pos->pieces[piece] & pos->colour[colour]; b; b &= b - 1)
+        board[LSB(b)] = piecechars[colour][piece];
+
+  /* The first field of the FEN. The occupied squares of the rank tell where the pieces go and what the */
+  /* runs of empty squares between them are, the table has it all written out but for the pieces */
+  for (rank = RANKS-1; rank >= 0; rank--) {
+    occupied = (pos->occupied >> (8 * rank)) & 0xFF;
+    template = rankfen[occupied];
+    for (i = 0, n = rankfenlen[occupied]; i < n; i++)
+      if ('*' == template[i]) { /* The next piece, from the a-file on */
+        *p++ = board[8 * rank + LSB(occupied)];
+        occupied &= occupied - 1;
+      } else
+        *p++ = template[i];
+    *p++ = '/';
+  }
+  p--; /* The last rank doesn't have "/" */
+
+  /* The second field */
+  *p++ = ' ';
+  *p++ = (pos->turn)?'w':'b';
+  *p++ = ' ';
+
+  /* The third field */
+  if (!pos->castling)
+    *p++ = '-';
+  if (pos->castling & CASTLEK)
+    *p++ = 'K';
+  if (pos->castling & CASTLEQ)
+    *p++ = 'Q';
+  if (pos->castling & CASTLEk)
+    *p++ = 'k';
+  if (pos->castling & CASTLEq)
+    *p++ = 'q';
+  *p++ = ' ';
+
+  /* The fourth field */
+  if (pos->enpassant != NOSQUARE) {
+    *p++ = 'a' + FILEOF(pos->enpassant);
+    *p++ = '1' + RANKOF(pos->enpassant);
+  } else
+    *p++ = '-';
+
+  /* The fifth and sixth fields */
+  *p++ = ' ';
+  p = write_number(p, pos->ply);
+  *p++ = ' ';
+  p = write_number(p, pos->fullmove);
+  *p = '\0';
+
+  if (fen == tmp) {
+    if ((size_t) (p - fen) >= size)
+      return PGN2FEN_ENOSPACE;
+    memcpy(buf, fen, p - fen + 1);
+  }
+  return p - fen;
+}
+
+/* Set up the position described by "fen". The clocks may be left out. Returns PGN2FEN_EFEN if it doesn't make sense */
+int pgn2fen_parse_fen (const char *fen, struct pgn2fen_position *pos) {
+
+  const char *p = fen, *q;
+  int file = 0, rank = RANKS-1, colour, piece;
+
+  pgn2fen_init_position(pos);
+  memset(pos->pieces, 0, sizeof(pos->pieces));
+  memset(pos->colour, 0, sizeof(pos->colour));
+  pos->castling = 0;
+
+  /* The pieces, from a8 to h1 */
+  for (; *p && !isspace((unsigned char) *p); p++)
+    if ('/' == *p) {
+      if (file != FILES || 0 == rank--)
+        return PGN2FEN_EFEN;
+      file = 0;
+    } else if (*p >= '1' && *p <= '8')
+      file += *p - '0';
+    else if ((q = memchr(piecechars[BLACK], *p, NPIECES)) != NULL || (q = memchr(piecechars[WHITE], *p, NPIECES)) != NULL) {
+      if (file >= FILES)
+        return PGN2FEN_EFEN;
+      colour = (q >= piecechars[WHITE]);
+      piece = q - piecechars[colour];
+      pos->pieces[piece] |= BIT(SQUARE(file, rank));
+      pos->colour[colour] |= BIT(SQUARE(file, rank));
+      file++;
+    } else
+      return PGN2FEN_EFEN;
+  if (file != FILES || rank != 0)
+    return PGN2FEN_EFEN;
+  pos->occupied = pos->colour[WHITE] | pos->colour[BLACK];
+
+  /* Side to move */
+  while (isspace((unsigned char) *p))
+    p++;
+  if ('w' != *p && 'b' != *p)
+    return PGN2FEN_EFEN;
+  pos->turn = ('w' == *p++)?WHITE:BLACK;
+
+  /* Castling rights */
+  while (isspace((unsigned char) *p))
+    p++;
+  for (; *p && !isspace((unsigned char) *p); p++)
+    switch (*p) {
+      case 'K': pos->castling |= CASTLEK; break;
+      case 'Q': pos->castling |= CASTLEQ; break;
+      case 'k': pos->castling |= CASTLEk; break;
+      case 'q': pos->castling |= CASTLEq; break;
+      case '-': break;
+      default: return PGN2FEN_EFEN;
+    }
+
+  /* Enpassant square */
+  while (isspace((unsigned char) *p))
+    p++;
+  if (*p >= 'a' && *p <= 'h' && p[1] >= '1' && p[1] <= '8') {
+    pos->enpassant = SQUARE(p[0] - 'a', p[1] - '1');
+    p += 2;
+  } else if ('-' == *p)
+    p++;
+  else
+    return PGN2FEN_EFEN;
+
+  /* The clocks, if they are there */
+  if (sscanf(p, "%d %d", &pos->ply, &pos->fullmove) < 2) {
+    pos->ply = 0;
+    pos->fullmove = 1;
+  }
+  pos->key = pgn2fen_key(pos);
+  return 0;
+}
+
+/* Whether the two positions are the same, clocks aside, and the enpassant square too if no pawn can use it */
+int pgn2fen_same_position (const struct pgn2fen_position *a, const struct pgn2fen_position *b) {
+  pthread_once(&tablesonce, init_tables); /* The en passant squares are looked up */
+  return !memcmp(a->pieces, b->pieces, sizeof(a->pieces)) && !memcmp(a->colour, b->colour, sizeof(a->colour)) &&
+         a->castling == b->castling && a->turn == b->turn && pgn2fen_enpassant(a) == pgn2fen_enpassant(b);
+}
@@ -0,0 +1,112 @@
+/*
+ *  pgn2fen - Extracts FEN of a specific move on a PGN game
+ *  -------------------------------------------------------
+ *  Author: mate_amargo - Juan Alberto Regalado Galván
+ *  https://github.com/mate-amargo/pgn2fen
+ *  -------------------------------------------------------
+ *
+ *  Looking for the next interesting byte many bytes at a time. Annotated games
+ *  are mostly commentaries, and all the tokenizer wants from them is where they
+ *  end. We use AVX2 if the CPU has it, SSE2 otherwise, and plain C elsewhere.
+ */
+
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCANX86
+#endif
+
+#include "board.h"
+
+/* One byte at a time, for the tails and for CPUs we don't have anything better for */
+static const char *scan_scalar (const char *p, const char *end, const char *set, int n) {
+  for (; p < end; p++)
+    if (*p == set[0] || *p == set[n > 1] || *p == set[(n > 2)?2:0] || *p == set[n - 1])
+      return p;
+  return end;
+}
+
+#ifdef SCANX86
+/* 16 bytes at a time. Comparing against the same character more than once is harmless, so the set is */
+/* always taken as four characters */
+__attribute__((target("sse2")))
+static const char *scan_sse2 (const char *p, const char *end, const char *set, int n) {
+  const __m128i c0 = _mm_set1_epi8(set[0]), c1 = _mm_set1_epi8(set[n > 1]);
+  const __m128i c2 = _mm_set1_epi8(set[(n > 2)?2:0]), c3 = _mm_set1_epi8(set[n - 1]);
+  __m128i v;
+  unsigned mask;
+  for (; end - p >= 16; p += 16) {
+    v = _mm_loadu_si128((const __m128i *) p);
+    mask = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, c0), _mm_cmpeq_epi8(v, c1)),
+                                          _mm_or_si128(_mm_cmpeq_epi8(v, c2), _mm_cmpeq_epi8(v, c3))));
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+  return scan_scalar(p, end, set, n);
+}
+
+/* 32 bytes at a time */
+__attribute__((target("avx2")))
+static const char *scan_avx2 (const char *p, const char *end, const char *set, int n) {
+  const __m256i c0 = _mm256_set1_epi8(set[0]), c1 = _mm256_set1_epi8(set[n > 1]);
+  const __m256i c2 = _mm256_set1_epi8(set[(n > 2)?2:0]), c3 = _mm256_set1_epi8(set[n - 1]);
+  __m256i v;
+  unsigned mask;
+  for (; end - p >= 32; p += 32) {
+    v = _mm256_loadu_si256((const __m256i *) p);
+    mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, c0), _mm256_cmpeq_epi8(v, c1)),
+                                                _mm256_or_si256(_mm256_cmpeq_epi8(v, c2), _mm256_cmpeq_epi8(v, c3))));
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+  return scan_sse2(p, end, set, n);
+}
+#endif
+
+static const char *(*scanner) (const char *, const char *, const char *, int) = scan_scalar;
+static pthread_once_t scanneronce = PTHREAD_ONCE_INIT;
+
+static void choose_scanner (void) {
+#ifdef SCANX86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    scanner = scan_avx2;
+  else if (__builtin_cpu_supports("sse2"))
+    scanner = scan_sse2;
+#endif
+}
+
+/* Pick the quickest way to scan this CPU has. Called when an input is opened */
+void pgn2fen_init_scan (void) {
+  pthread_once(&scanneronce, choose_scanner);
+}
+
+/* The first byte of [p, end) that is one of the "n" (1 to 4) characters of "set". Returns "end" if there's none */
+const char *pgn2fen_scan (const char *p, const char *end, const char *set, int n) {
+  return scanner(p, end, set, n);
+}
+
+/* Where the variation that begins at "p" (a "(") ends: the ")" that closes it. Variations may be nested, and */
+/* parentheses inside commentaries don't count. Returns NULL if it doesn't end before "end" */
+const char *pgn2fen_skip_variation (const char *p, const char *end) {
+  int depth = 0;
+  for (; (p = scanner(p, end, "(){;", 4)) < end; p++)
+    switch (*p) {
+      case '(':
+        depth++;
+        break;
+      case ')':
+        if (0 == --depth)
+          return p;
+        break;
+      case '{':
+        if ((p = scanner(p + 1, end, "}", 1)) == end)
+          return NULL;
+        break;
+      case ';':
+        if ((p = scanner(p + 1, end, "\n", 1)) == end)
+          return NULL;
+        break;
+    }
+  return NULL;
+}
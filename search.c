@@ -0,0 +1,70 @@
+/*
+ *  pgn2fen - Extracts FEN of a specific move on a PGN game
+ *  -------------------------------------------------------
+ *  Author: mate_amargo - Juan Alberto Regalado Galván
+ *  https://github.com/mate-amargo/pgn2fen
+ *  -------------------------------------------------------
+ *
+ *  Searching games for a position without an index. Some things never come
+ *  back once they are gone: pawns only move forward and pieces only get
+ *  captured, castling rights are lost for good. So as soon as a game loses
+ *  something the position we look for still has, the rest of it is read past
+ *  without playing it.
+ */
+
+#include <string.h>
+
+#include "board.h"
+
+/* Get ready to look for "pos": count what it has that a game can't get back */
+void pgn2fen_init_target (struct pgn2fen_target *t, const struct pgn2fen_position *pos) {
+  int colour, piece;
+  memset(t, 0, sizeof(*t));
+  t->pos = *pos;
+  for (colour = BLACK; colour <= WHITE; colour++) {
+    for (piece = PAWN; piece < NPIECES; piece++)
+      t->count[colour][piece] = __builtin_popcountll(pos->pieces[piece] & pos->colour[colour]);
+    t->men[colour] = __builtin_popcountll(pos->colour[colour]);
+  }
+  /* Pawns still on their starting squares never moved, nothing else can get there */
+  t->home[WHITE] = pos->pieces[PAWN] & pos->colour[WHITE] & RANK2;
+  t->home[BLACK] = pos->pieces[PAWN] & pos->colour[BLACK] & RANK7;
+}
+
+/* Whether a game at "pos" could still get to the target. If not, it never will */
+int pgn2fen_reachable (const struct pgn2fen_target *t, const struct pgn2fen_position *pos) {
+  int colour, piece, pawns, missing;
+  if (t->pos.castling & ~pos->castling)
+    return 0;
+  for (colour = BLACK; colour <= WHITE; colour++) {
+    if (t->home[colour] & ~(pos->pieces[PAWN] & pos->colour[colour]))
+      return 0;
+    if (__builtin_popcountll(pos->colour[colour]) < t->men[colour])
+      return 0;
+    /* Pieces we are short of can only come from promoting the pawns the target doesn't need */
+    if ((pawns = __builtin_popcountll(pos->pieces[PAWN] & pos->colour[colour]) - t->count[colour][PAWN]) < 0)
+      return 0;
+    for (missing = 0, piece = KNIGHT; piece < KING; piece++)
+      if (t->count[colour][piece] > __builtin_popcountll(pos->pieces[piece] & pos->colour[colour]))
+        missing += t->count[colour][piece] - __builtin_popcountll(pos->pieces[piece] & pos->colour[colour]);
+    if (missing > pawns)
+      return 0;
+  }
+  return 1;
+}
+
+/* Replay the game until it reaches the target, or until it can't anymore. Returns 1 if it got there, */
+/* with "g" at the position, to be read past by the caller. 0 if it didn't, with the rest of the game */
+/* already read past, or an error if the input couldn't be read */
+int pgn2fen_search_game (struct pgn2fen_input *in, struct pgn2fen_game *g, const struct pgn2fen_target *t) {
+  int moved;
+  while ((moved = pgn2fen_next_move(in, g, 1)) > 0) {
+    if (g->pos.key == t->pos.key && pgn2fen_same_position(&g->pos, &t->pos))
+      return 1;
+    if (!pgn2fen_reachable(t, &g->pos))
+      break;
+  }
+  if (moved != 0)
+    pgn2fen_skip_game(in, g);
+  return in->error;
+}
@@ -0,0 +1,59 @@
+/*
+ *  pgn2fen - Extracts FEN of a specific move on a PGN game
+ *  -------------------------------------------------------
+ *  Author: mate_amargo - Juan Alberto Regalado Galván
+ *  https://github.com/mate-amargo/pgn2fen
+ *  -------------------------------------------------------
+ *
+ *  Statistics: what the library went through, counted as it goes. Only when
+ *  built with PGN2FEN_STATS, otherwise the counters aren't there at all.
+ */
+
+#include <time.h>
+
+#include "board.h"
+
+#ifdef PGN2FEN_STATS
+/* Each thread counts on its own, so counting costs an add and nothing more */
+__thread struct pgn2fen_stats pgn2fen_counters;
+
+/* Seconds gone by, and seconds of CPU used by this thread */
+void pgn2fen_stats_clock (double *wall, double *cpu) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  *wall = t.tv_sec + t.tv_nsec / 1e9;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+  *cpu = t.tv_sec + t.tv_nsec / 1e9;
+}
+#endif
+
+/* Add what this thread counted so far to "stats". Returns 0 if we weren't built with PGN2FEN_STATS, */
+/* in which case there's nothing to add. Two calls apart tell what happened in between */
+int pgn2fen_stats (struct pgn2fen_stats *stats) {
+#ifdef PGN2FEN_STATS
+  struct pgn2fen_stats *c = &pgn2fen_counters;
+  int i;
+  stats->bytes += c->bytes;
+  stats->tokens += c->tokens;
+  stats->plies += c->plies;
+  stats->tagbytes += c->tagbytes;
+  stats->commentbytes += c->commentbytes;
+  for (i = 0; i < 6; i++) {
+    stats->resolved[i] += c->resolved[i];
+    stats->candidates[i] += c->candidates[i];
+    stats->disambiguated[i] += c->disambiguated[i];
+  }
+  stats->castles += c->castles;
+  stats->enpassant += c->enpassant;
+  stats->promotions += c->promotions;
+  stats->doublepushes += c->doublepushes;
+  stats->openwall += c->openwall;
+  stats->opencpu += c->opencpu;
+  stats->readwall += c->readwall;
+  stats->readcpu += c->readcpu;
+  return 1;
+#else
+  (void) stats;
+  return 0;
+#endif
+}
@@ -0,0 +1,180 @@
+/*
+ *  pgn2fen - Extracts FEN of a specific move on a PGN game
+ *  -------------------------------------------------------
+ *  Author: mate_amargo - Juan Alberto Regalado Galván
+ *  https://github.com/mate-amargo/pgn2fen
+ *  -------------------------------------------------------
+ *
+ *  Tags: the ones we keep of each game, and filters on them like
+ *  "WhiteElo>=2500 && ECO=B90", so games that don't pass can be read past
+ *  without replaying them.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stddef.h>
+#include <ctype.h>
+
+#include "board.h"
+
+#define ELO -1 /* Not a string, kept as a number */
+
+/* The tags we keep, and where */
+static const struct {
+  const char *name;
+  size_t offset, size; /* The string it goes into, or the number if the size is ELO */
+} tagnames[] = {
+  { "Event", offsetof(struct pgn2fen_tags, event), sizeof(((struct pgn2fen_tags *) 0)->event) },
+  { "Site", offsetof(struct pgn2fen_tags, site), sizeof(((struct pgn2fen_tags *) 0)->site) },
+  { "Date", offsetof(struct pgn2fen_tags, date), sizeof(((struct pgn2fen_tags *) 0)->date) },
+  { "Round", offsetof(struct pgn2fen_tags, round), sizeof(((struct pgn2fen_tags *) 0)->round) },
+  { "White", offsetof(struct pgn2fen_tags, white), sizeof(((struct pgn2fen_tags *) 0)->white) },
+  { "Black", offsetof(struct pgn2fen_tags, black), sizeof(((struct pgn2fen_tags *) 0)->black) },
+  { "Result", offsetof(struct pgn2fen_tags, result), sizeof(((struct pgn2fen_tags *) 0)->result) },
+  { "WhiteElo", offsetof(struct pgn2fen_tags, whiteelo), (size_t) ELO },
+  { "BlackElo", offsetof(struct pgn2fen_tags, blackelo), (size_t) ELO },
+  { "ECO", offsetof(struct pgn2fen_tags, eco), sizeof(((struct pgn2fen_tags *) 0)->eco) },
+  { "TimeControl", offsetof(struct pgn2fen_tags, timecontrol), sizeof(((struct pgn2fen_tags *) 0)->timecontrol) }
+};
+#define NTAGS ((int) (sizeof(tagnames) / sizeof(tagnames[0])))
+
+/* Keep the value of a tag line like [White "Kasparov, Garry"], from "line" up to "end", if it's one */
+/* of ours. Values too long for their field are cut */
+void pgn2fen_read_tag (const char *line, const char *end, struct pgn2fen_tags *tags) {
+  const char *p = line + 1, *name;
+  char value[PGN2FEN_TAGSIZE], *field;
+  size_t len, n = 0;
+  int i;
+  while (p < end && isspace((unsigned char) *p))
+    p++;
+  for (name = p; p < end && (isalnum((unsigned char) *p) || '_' == *p); p++);
+  len = p - name;
+  for (i = 0; i < NTAGS && (strlen(tagnames[i].name) != len || memcmp(tagnames[i].name, name, len)); i++);
+  if (NTAGS == i || (p = memchr(p, '"', end - p)) == NULL)
+    return;
+  for (p++; p < end && '"' != *p && n < sizeof(value) - 1; p++) {
+    if ('\\' == *p && p + 1 < end) /* Escaped quote or backslash */
+      p++;
+    value[n++] = *p;
+  }
+  value[n] = '\0';
+  field = (char *) tags + tagnames[i].offset;
+  if ((size_t) ELO == tagnames[i].size)
+    *(int *) field = atoi(value);
+  else {
+    n = (n < tagnames[i].size)?n:tagnames[i].size - 1;
+    memcpy(field, value, n);
+    field[n] = '\0';
+  }
+}
+
+/* Understand a filter like "WhiteElo>=2500 && ECO=B90 || Black=Carlsen*". Each condition is a tag, one */
+/* of = != < <= > >= and a value, quoted if it has spaces. "&&" goes before "||". Elos are compared as */
+/* numbers, the rest as strings, and a value ending in "*" matches any string that begins like it. */
+/* Returns PGN2FEN_EFILTER if it doesn't make sense */
+int pgn2fen_parse_filter (const char *expr, struct pgn2fen_filter *f) {
+
+  struct pgn2fen_condition *c;
+  const char *p = expr, *name, *value;
+  size_t len;
+  int or = 0;
+
+  memset(f, 0, sizeof(*f));
+  for (;;) {
+    if (PGN2FEN_MAXCONDITIONS == f->n)
+      return PGN2FEN_EFILTER;
+    c = &f->conditions[f->n++];
+    c->or = or;
+
+    /* The tag */
+    while (isspace((unsigned char) *p))
+      p++;
+    for (name = p; isalnum((unsigned char) *p) || '_' == *p; p++);
+    for (c->tag = 0; c->tag < NTAGS && (strlen(tagnames[c->tag].name) != (size_t) (p - name) ||
+                                        strncasecmp(tagnames[c->tag].name, name, p - name)); c->tag++);
+    if (NTAGS == c->tag)
+      return PGN2FEN_EFILTER;
+
+    /* What it's compared with */
+    while (isspace((unsigned char) *p))
+      p++;
+    if ('=' == *p)
+      c->op = ('=' == *++p)?(p++, PGN2FEN_EQ):PGN2FEN_EQ;
+    else if ('!' == p[0] && '=' == p[1])
+      c->op = (p += 2, PGN2FEN_NE);
+    else if ('<' == *p)
+      c->op = ('=' == *++p)?(p++, PGN2FEN_LE):PGN2FEN_LT;
+    else if ('>' == *p)
+      c->op = ('=' == *++p)?(p++, PGN2FEN_GE):PGN2FEN_GT;
+    else
+      return PGN2FEN_EFILTER;
+
+    /* The value, up to the next "&&" or "||" */
+    while (isspace((unsigned char) *p))
+      p++;
+    if ('"' == *p) {
+      for (value = ++p; *p && '"' != *p; p++);
+      if (!*p)
+        return PGN2FEN_EFILTER;
+      len = p++ - value;
+    } else {
+      for (value = p; *p && strncmp(p, "&&", 2) && strncmp(p, "||", 2); p++);
+      for (len = p - value; len && isspace((unsigned char) value[len-1]); len--);
+      if (!len)
+        return PGN2FEN_EFILTER;
+    }
+    if (len >= sizeof(c->value))
+      return PGN2FEN_EFILTER;
+    memcpy(c->value, value, len);
+    c->value[len] = '\0';
+    c->number = atol(c->value);
+    if ((len && '*' == c->value[len-1]) && (PGN2FEN_EQ == c->op || PGN2FEN_NE == c->op)) {
+      c->prefix = 1;
+      c->value[len-1] = '\0';
+    }
+
+    while (isspace((unsigned char) *p))
+      p++;
+    if (!*p)
+      return 0;
+    if (strncmp(p, "&&", 2) && strncmp(p, "||", 2))
+      return PGN2FEN_EFILTER;
+    or = ('|' == *p);
+    p += 2;
+  }
+}
+
+static int test (const struct pgn2fen_condition *c, const struct pgn2fen_tags *tags) {
+  const char *field = (const char *) tags + tagnames[c->tag].offset;
+  long diff;
+  if ((size_t) ELO == tagnames[c->tag].size)
+    diff = *(const int *) field - c->number;
+  else if (c->prefix)
+    diff = strncmp(field, c->value, strlen(c->value));
+  else
+    diff = strcmp(field, c->value);
+  switch (c->op) {
+    case PGN2FEN_EQ: return 0 == diff;
+    case PGN2FEN_NE: return 0 != diff;
+    case PGN2FEN_LT: return diff < 0;
+    case PGN2FEN_LE: return diff <= 0;
+    case PGN2FEN_GT: return diff > 0;
+    case PGN2FEN_GE: return diff >= 0;
+  }
+  return 0;
+}
+
+/* Whether a game with these tags passes the filter. Missing tags are empty, missing Elos are 0 */
+int pgn2fen_filter_match (const struct pgn2fen_filter *f, const struct pgn2fen_tags *tags) {
+  int i, all = 1; /* So far in the conditions joined by "&&" */
+  for (i = 0; i < f->n; i++) {
+    if (f->conditions[i].or) {
+      if (all)
+        return 1;
+      all = 1;
+    }
+    all = all && test(&f->conditions[i], tags);
+  }
+  return all;
+}
@@ -0,0 +1,216 @@
+#!/bin/sh
+#
+#  pgn2fen - Extracts FEN of a specific move on a PGN game
+#  -------------------------------------------------------
+#  Checks of the command line against what we know it must print. Each one
+#  runs pgn2fen on a few games written here and compares the output, or on a
+#  database made up by pgngen and compares two ways of getting the same thing.
+#
+#  Usage: tests/check.sh [path/to/pgn2fen] [path/to/pgngen]    (make check runs it)
+
+PGN2FEN=${1:-./pgn2fen}
+PGNGEN=${2:-bench/pgngen}
+TMP=$(mktemp -d) || exit 1
+trap 'rm -rf "$TMP"' EXIT
+failed=0
+
+# expect name expected command...: run the command and compare what it prints with "expected"
+expect () {
+  name=$1 expected=$2
+  shift 2
+  got=$("$@" 2>&1)
+  if [ "$got" = "$expected" ]; then
+    echo "ok      $name"
+  else
+    echo "FAILED  $name"
+    echo "  expected: $expected" | sed '2,$s/^/            /'
+    echo "  got:      $got" | sed '2,$s/^/            /'
+    failed=1
+  fi
+}
+
+# match name command1 command2: both shell commands must print the same, and something
+match () {
+  sh -c "$2" > "$TMP/match1" 2>&1
+  sh -c "$3" > "$TMP/match2" 2>&1
+  if [ -s "$TMP/match1" ] && cmp -s "$TMP/match1" "$TMP/match2"; then
+    echo "ok      $1"
+  else
+    echo "FAILED  $1"
+    diff "$TMP/match1" "$TMP/match2" | head -5 | sed 's/^/          /'
+    failed=1
+  fi
+}
+
+# A few megabytes of games, more than one chunk for -j and more positions than -U -m 1 keeps in memory
+"$PGNGEN" -m 4 > "$TMP/plain.pgn" || exit 1
+
+# The same position by two move orders. The first has "d3" in its FEN, but no black pawn can take on it
+cat > "$TMP/transposition.pgn" <<'PGN'
+[Event "a"]
+
+1. Nf3 d5 2. d4 *
+
+[Event "b"]
+
+1. d4 d5 2. Nf3 *
+PGN
+
+expect "-U counts a transposition once" \
+  "2 rnbqkbnr/ppp1pppp/8/3p4/3P4/5N2/PPP1PPPP/RNBQKB1R b KQkq -" \
+  sh -c "$PGN2FEN -U '$TMP/transposition.pgn' | grep '^2 '"
+
+expect "-s finds both move orders of a transposition" \
+  "1 0 3 rnbqkbnr/ppp1pppp/8/3p4/3P4/5N2/PPP1PPPP/RNBQKB1R b KQkq d3 0 2
+2 32 3 rnbqkbnr/ppp1pppp/8/3p4/3P4/5N2/PPP1PPPP/RNBQKB1R b KQkq - 1 2" \
+  $PGN2FEN -s "rnbqkbnr/ppp1pppp/8/3p4/3P4/5N2/PPP1PPPP/RNBQKB1R b KQkq -" "$TMP/transposition.pgn"
+
+# Right after a double push, with the "-" FEN people usually type
+cat > "$TMP/e4.pgn" <<'PGN'
+[Event "a"]
+
+1. e4 e5 *
+
+[Event "b"]
+
+1. d4 d5 *
+PGN
+
+expect "-s with - finds a position right after a double push" \
+  "1 0 1 rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1" \
+  $PGN2FEN -s "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1" "$TMP/e4.pgn"
+
+"$PGN2FEN" -i "$TMP/e4.idx" "$TMP/e4.pgn"
+expect "-q with - finds a position right after a double push" \
+  "0 1 rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1" \
+  $PGN2FEN -q "$TMP/e4.idx" "$TMP/e4.pgn" "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq -"
+
+# Moves no piece can make are refused, not played anyhow
+printf '1. e4 e5 2. O-O *\n' > "$TMP/castle.pgn"
+expect "O-O with pieces in the way is refused" \
+  "*** Error: The game has a move that can't be played" \
+  $PGN2FEN "$TMP/castle.pgn" 2
+
+printf '1. e4 e5 2. Nf3 Nc6 3. Bc4 Bc5 4. O-O *\n' > "$TMP/castled.pgn"
+expect "O-O with the way clear is played" \
+  "r1bqk1nr/pppp1ppp/2n5/2b1p3/2B1P3/5N2/PPPP1PPP/RNBQ1RK1 b kq - 5 4" \
+  $PGN2FEN "$TMP/castled.pgn" 4
+
+printf '1. e4 b6 2. g3 Ba6 3. Bg2 e6 4. Nf3 Nc6 5. O-O *\n' > "$TMP/through.pgn"
+expect "O-O through a square the bishop on a6 sees is refused" \
+  "*** Error: The game has a move that can't be played" \
+  $PGN2FEN "$TMP/through.pgn" 5
+
+printf '1. e1 *\n' > "$TMP/pawn.pgn"
+expect "A pawn move to its own back rank is refused" \
+  "*** Error: The game has a move that can't be played" \
+  $PGN2FEN "$TMP/pawn.pgn" 1
+
+printf '1. h4 g5 2. hxg5 Nf6 3. g6 e6 4. g7 Be7 5. g8 *\n' > "$TMP/nopromotion.pgn"
+expect "A pawn reaching the last rank without promoting is refused" \
+  "*** Error: The game has a move that can't be played" \
+  $PGN2FEN "$TMP/nopromotion.pgn" 5
+
+printf '1. h4 g5 2. hxg5 Nf6 3. g6 e6 4. g7 Be7 5. g8=Q *\n' > "$TMP/promotion.pgn"
+expect "A pawn promoting on the last rank is played" \
+  "rnbqk1Qr/ppppbp1p/4pn2/8/8/8/PPPPPPP1/RNBQKBNR b KQkq - 0 5" \
+  $PGN2FEN "$TMP/promotion.pgn" 5
+
+printf '1. e4=Q *\n' > "$TMP/early.pgn"
+expect "A pawn promoting before the last rank is refused" \
+  "*** Error: The game has a move that can't be played" \
+  $PGN2FEN "$TMP/early.pgn" 1
+
+gzip -c "$TMP/pawn.pgn" > "$TMP/pawn.pgn.gz"
+expect "-b asks for compressed files to be decompressed" \
+  "*** Error: -b needs regular uncompressed PGN files, \"$TMP/pawn.pgn.gz\" isn't one" \
+  sh -c "echo '$TMP/pawn.pgn.gz 1 1' | $PGN2FEN -b"
+
+match "-U spilling to temporary files counts the same as in memory" \
+  "$PGN2FEN -U '$TMP/plain.pgn'" "$PGN2FEN -U -m 1 '$TMP/plain.pgn'"
+
+cat "$TMP/e4.pgn" "$TMP/castle.pgn" > "$TMP/broken.pgn"
+expect "-U warns about a game with a move that can't be played" \
+  "*** Warning: Game 3 has a move that can't be played, skipping the rest of it" \
+  sh -c "$PGN2FEN -U '$TMP/broken.pgn' 2>&1 >/dev/null"
+
+# The same games read through a pipe and through a mapping, every position of every game
+match "A pipe reads the same as a mapped file" \
+  "$PGN2FEN -d -a '$TMP/plain.pgn' 1" "cat '$TMP/plain.pgn' | $PGN2FEN -d -a - 1"
+
+expect "-a prints every ply from the move given, up to -u" \
+  "1 rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1
+2 rnbqkbnr/pppp1ppp/8/4p3/4P3/8/PPPP1PPP/RNBQKBNR w KQkq e6 0 2" \
+  $PGN2FEN -a -u 1b "$TMP/castled.pgn" 1
+
+match "-d -j 3 prints what a single thread does" \
+  "$PGN2FEN -d -a '$TMP/plain.pgn' 1" "$PGN2FEN -d -j 3 -a '$TMP/plain.pgn' 1"
+
+expect "-b says which game doesn't exist and goes on" \
+  "*** Error: Game number 9 does not exist
+rnbqkbnr/ppp1pppp/8/3p4/3P4/8/PPP1PPPP/RNBQKBNR w KQkq d6 0 2" \
+  sh -c "printf '$TMP/e4.pgn 9 1\n$TMP/e4.pgn 2 1 b\n' | $PGN2FEN -b"
+
+cp "$TMP/e4.pgn" "$TMP/games.pgn"
+expect "--game finds a game and keeps its offset in a .gidx" \
+  "rnbqkbnr/ppp1pppp/8/3p4/3P4/8/PPP1PPPP/RNBQKBNR w KQkq d6 0 2
+gidx" \
+  sh -c "$PGN2FEN -g 2 '$TMP/games.pgn' 1 b && test -s '$TMP/games.pgn.gidx' && echo gidx"
+
+printf '\n[Event "c"]\n\n1. c4 c5 *\n' >> "$TMP/games.pgn"
+expect "--game rebuilds the .gidx when the file changed" \
+  "rnbqkbnr/pp1ppppp/8/2p5/2P5/8/PP1PPPPP/RNBQKBNR w KQkq c6 0 2" \
+  $PGN2FEN -g 3 "$TMP/games.pgn" 1 b
+
+gzip -c "$TMP/plain.pgn" > "$TMP/plain.pgn.gz"
+match "gzip input reads the same as the PGN" \
+  "$PGN2FEN -d -a '$TMP/plain.pgn' 1" "$PGN2FEN -d -a '$TMP/plain.pgn.gz' 1"
+
+"$PGN2FEN" -c "$TMP/plain.bin" "$TMP/plain.pgn"
+match "A binary database replays like its PGN" \
+  "$PGN2FEN -d -a '$TMP/plain.pgn' 1" "$PGN2FEN -d -a '$TMP/plain.bin' 1"
+
+# Two games with tags, the first with a variation inside a variation
+cat > "$TMP/tagged.pgn" <<'PGN'
+[Event "a"]
+[White "Kasparov"]
+[WhiteElo "2800"]
+
+1. e4 e5 (1... c5 2. Nf3 (2. c3)) 2. Nf3 *
+
+[Event "b"]
+[White "Karpov"]
+[WhiteElo "2700"]
+
+1. d4 d5 *
+PGN
+
+expect "-V labels each position with its variation" \
+  "0 1 rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1
+0 2 rnbqkbnr/pppp1ppp/8/4p3/4P3/8/PPPP1PPP/RNBQKBNR w KQkq e6 0 2
+2.1 2 rnbqkbnr/pp1ppppp/8/2p5/4P3/8/PPPP1PPP/RNBQKBNR w KQkq c6 0 2
+2.1 3 rnbqkbnr/pp1ppppp/8/2p5/4P3/5N2/PPPP1PPP/RNBQKB1R b KQkq - 1 2
+2.1,3.1 3 rnbqkbnr/pp1ppppp/8/2p5/4P3/2P5/PP1P1PPP/RNBQKBNR b KQkq - 0 2
+0 3 rnbqkbnr/pppp1ppp/8/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R b KQkq - 1 2" \
+  $PGN2FEN -V -a "$TMP/tagged.pgn" 1
+
+expect "--where compares Elos as numbers" \
+  "1 0 rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1" \
+  $PGN2FEN -d --where "WhiteElo>=2750" "$TMP/tagged.pgn" 1
+
+expect "--where matches the beginning of a name" \
+  "2 94 rnbqkbnr/ppp1pppp/8/3p4/3P4/8/PPP1PPPP/RNBQKBNR w KQkq d6 0 2" \
+  $PGN2FEN -d --where "White=Karp* && WhiteElo<2750" "$TMP/tagged.pgn" 1 b
+
+# -f waits for a move cut in two by the end of the file instead of playing half of it
+printf '[Event "a"]\n\n1. e4 e5 2. Nf' > "$TMP/growing.pgn"
+timeout 3 "$PGN2FEN" -f "$TMP/growing.pgn" > "$TMP/followed.txt" 2>&1 &
+sleep 1
+printf '3 Nc6 *\n' >> "$TMP/growing.pgn"
+wait
+expect "-f waits for the rest of a move the file ends in" \
+  "1 0 3 rnbqkbnr/pppp1ppp/8/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R b KQkq - 1 2
+1 0 4 r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq - 2 3" \
+  tail -2 "$TMP/followed.txt"
+
+exit $failed
@@ -0,0 +1,286 @@
+/*
+ *  pgn2fen - Extracts FEN of a specific move on a PGN game
+ *  -------------------------------------------------------
+ *  Author: mate_amargo - Juan Alberto Regalado Galván
+ *  https://github.com/mate-amargo/pgn2fen
+ *  -------------------------------------------------------
+ *
+ *  Sets of positions, counting how many times each one was added. Positions
+ *  go into open addressing hash tables, one per shard of the keys, each with
+ *  its own lock so threads adding positions rarely wait for each other. Tables
+ *  start small and double as they fill, up to their share of the memory we
+ *  were given. When one can't grow any more it's sorted and spilled to a
+ *  temporary file, and at the end
+ *  the runs of each shard are merged, adding up the counts of the positions
+ *  they share.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "board.h"
+
+#define SETSHARDS 64          /* The top bits of the key choose the shard, so shards hold ranges of keys in order */
+#define SETSHARDBITS 6
+#define SETMINSLOTS (1 << 10) /* Each table starts with this many slots, and can have them whatever the budget */
+
+/* A position packed in a few bytes: which squares are occupied, and what's on them, a nibble each */
+/* from a1 on. Colour in the high bit of the nibble. The clocks are left out, the key doesn't have them */
+struct packed {
+  uint64_t occupied;
+  uint8_t pieces[16];
+  uint8_t castling;
+  uint8_t turn;
+  int8_t enpassant;
+  uint8_t unused[5]; /* So there's no padding, they are compared with memcmp */
+};
+
+struct setentry {
+  uint64_t key;
+  uint64_t count; /* 0 for an empty slot */
+  struct packed pos;
+};
+
+/* A sorted run of a shard, spilled to a temporary file */
+struct setrun {
+  FILE *f;
+  struct setentry next; /* The lowest entry we haven't merged yet */
+  int done;
+};
+
+struct shard {
+  pthread_mutex_t lock;
+  struct setentry *slots;
+  size_t size; /* Slots it has now, a power of two */
+  size_t used;
+  struct setrun *runs;
+  int nruns;
+};
+
+static int pack (const struct pgn2fen_position *pos, struct packed *p) {
+  bitboard b;
+  int piece, sq, n = 0;
+  memset(p, 0, sizeof(*p));
+  if (__builtin_popcountll(pos->occupied) > 32) /* Not from a game */
+    return PGN2FEN_EILLEGAL;
+  p->occupied = pos->occupied;
+  for (b = pos->occupied; b; b &= b - 1, n++) {
+    sq = LSB(b);
+    for (piece = PAWN; !(pos->pieces[piece] & BIT(sq)); piece++);
+    p->pieces[n / 2] |= (piece | ((pos->colour[WHITE] & BIT(sq))?8:0)) << (4 * (n % 2));
+  }
+  p->castling = pos->castling;
+  p->turn = pos->turn;
+  p->enpassant = pgn2fen_enpassant(pos); /* Only if it can be used, or the same position would be two */
+  return 0;
+}
+
+static void unpack (const struct setentry *e, struct pgn2fen_position *pos) {
+  bitboard b;
+  int nibble, n = 0;
+  memset(pos, 0, sizeof(*pos));
+  for (b = e->pos.occupied; b; b &= b - 1, n++) {
+    nibble = (e->pos.pieces[n / 2] >> (4 * (n % 2))) & 15;
+    pos->pieces[nibble & 7] |= BIT(LSB(b));
+    pos->colour[(nibble & 8)?WHITE:BLACK] |= BIT(LSB(b));
+  }
+  pos->occupied = e->pos.occupied;
+  pos->castling = e->pos.castling;
+  pos->turn = e->pos.turn;
+  pos->enpassant = e->pos.enpassant;
+  pos->fullmove = 1;
+  pos->key = e->key;
+}
+
+/* By key, and by position for the rare keys two positions share */
+static int compare_entries (const void *a, const void *b) {
+  const struct setentry *x = a, *y = b;
+  if (x->key != y->key)
+    return (x->key < y->key)?-1:1;
+  return memcmp(&x->pos, &y->pos, sizeof(x->pos));
+}
+
+/* Get ready for up to "budget" bytes of tables, split among the shards. Each one can grow up to a power */
+/* of two slots, it starts with a few */
+int pgn2fen_set_open (struct pgn2fen_set *set, size_t budget) {
+  struct shard *shards;
+  size_t slots = SETMINSLOTS;
+  int i;
+  memset(set, 0, sizeof(*set));
+  while (2 * slots * sizeof(struct setentry) * SETSHARDS <= budget)
+    slots *= 2;
+  if ((shards = calloc(SETSHARDS, sizeof(struct shard))) == NULL)
+    return PGN2FEN_ENOMEM;
+  set->shards = shards;
+  set->slots = slots;
+  for (i = 0; i < SETSHARDS; i++)
+    pthread_mutex_init(&shards[i].lock, NULL);
+  for (i = 0; i < SETSHARDS; i++) {
+    shards[i].size = SETMINSLOTS;
+    if ((shards[i].slots = calloc(SETMINSLOTS, sizeof(struct setentry))) == NULL) {
+      pgn2fen_set_close(set);
+      return PGN2FEN_ENOMEM;
+    }
+  }
+  return 0;
+}
+
+/* Twice as many slots for a shard, with its positions where they go in the bigger table. Returns 0 if */
+/* there's no memory for it */
+static int grow_shard (struct shard *s) {
+  struct setentry *slots;
+  size_t i, j, mask = 2 * s->size - 1;
+  if ((slots = calloc(2 * s->size, sizeof(struct setentry))) == NULL)
+    return 0;
+  for (i = 0; i < s->size; i++)
+    if (s->slots[i].count) {
+      for (j = s->slots[i].key & mask; slots[j].count; j = (j + 1) & mask);
+      slots[j] = s->slots[i];
+    }
+  free(s->slots);
+  s->slots = slots;
+  s->size *= 2;
+  return 1;
+}
+
+/* Sort the positions of a shard and put them aside in a temporary file, leaving its table empty */
+static int spill_shard (struct shard *s) {
+  struct setrun *tmp;
+  size_t i, n = 0;
+  FILE *f;
+  for (i = 0; i < s->size; i++) /* Pack them at the beginning */
+    if (s->slots[i].count)
+      s->slots[n++] = s->slots[i];
+  qsort(s->slots, n, sizeof(struct setentry), compare_entries);
+  if ((f = tmpfile()) == NULL)
+    return PGN2FEN_EWRITE;
+  if (fwrite(s->slots, sizeof(struct setentry), n, f) != n) {
+    fclose(f);
+    return PGN2FEN_EWRITE;
+  }
+  rewind(f);
+  if ((tmp = realloc(s->runs, (s->nruns + 1) * sizeof(struct setrun))) == NULL) {
+    fclose(f);
+    return PGN2FEN_ENOMEM;
+  }
+  s->runs = tmp;
+  s->runs[s->nruns].f = f;
+  s->runs[s->nruns].done = (fread(&s->runs[s->nruns].next, sizeof(struct setentry), 1, f) != 1);
+  s->nruns++;
+  memset(s->slots, 0, s->size * sizeof(struct setentry)); /* Packing left copies behind the first n too */
+  s->used = 0;
+  return 0;
+}
+
+/* Count one more of "pos". Threads may add at the same time */
+int pgn2fen_set_add (struct pgn2fen_set *set, const struct pgn2fen_position *pos) {
+
+  struct shard *s = (struct shard *) set->shards + (pos->key >> (64 - SETSHARDBITS));
+  struct setentry *e;
+  struct packed p;
+  size_t i, mask;
+  int error = 0;
+
+  if ((error = pack(pos, &p)) < 0)
+    return error;
+  pthread_mutex_lock(&s->lock);
+  mask = s->size - 1;
+  for (i = pos->key & mask; ; i = (i + 1) & mask) { /* Linear probing, until we find it or an empty slot */
+    e = &s->slots[i];
+    if (!e->count) {
+      e->key = pos->key;
+      e->count = 1;
+      e->pos = p;
+      if (++s->used > s->size / 4 * 3 && (s->size == set->slots || !grow_shard(s))) /* Too full, and it can't grow */
+        error = spill_shard(s);
+      break;
+    }
+    if (e->key == pos->key && !memcmp(&e->pos, &p, sizeof(p))) {
+      e->count++;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&s->lock);
+  return error;
+}
+
+/* No more positions are coming. Shards that were spilled put the rest aside too, to be merged with */
+/* the runs they have, and the others are sorted where they are */
+int pgn2fen_set_finish (struct pgn2fen_set *set) {
+  struct shard *s;
+  size_t i, n;
+  int error;
+  for (s = set->shards; s < (struct shard *) set->shards + SETSHARDS; s++)
+    if (s->nruns && s->used) {
+      if ((error = spill_shard(s)) < 0)
+        return error;
+    } else if (!s->nruns) {
+      for (i = n = 0; i < s->size; i++)
+        if (s->slots[i].count)
+          s->slots[n++] = s->slots[i];
+      qsort(s->slots, n, sizeof(struct setentry), compare_entries);
+      s->used = n;
+    }
+  set->shard = 0;
+  set->next = 0;
+  return 0;
+}
+
+/* The lowest entry of the runs of "s", with the counts of all the runs that have it added up. Returns */
+/* 0 if they are all done */
+static int merge_next (struct shard *s, struct setentry *e) {
+  struct setrun *lowest = NULL;
+  int i;
+  for (i = 0; i < s->nruns; i++)
+    if (!s->runs[i].done && (!lowest || compare_entries(&s->runs[i].next, &lowest->next) < 0))
+      lowest = &s->runs[i];
+  if (!lowest)
+    return 0;
+  *e = lowest->next;
+  e->count = 0;
+  for (i = 0; i < s->nruns; i++)
+    while (!s->runs[i].done && !compare_entries(&s->runs[i].next, e)) {
+      e->count += s->runs[i].next.count;
+      s->runs[i].done = (fread(&s->runs[i].next, sizeof(struct setentry), 1, s->runs[i].f) != 1);
+    }
+  return 1;
+}
+
+/* After pgn2fen_set_finish, the positions one by one in order of their keys, with how many times each */
+/* was added. Their clocks are 0 and 1, they aren't kept. Returns 1, or 0 when there are no more */
+int pgn2fen_set_next (struct pgn2fen_set *set, struct pgn2fen_position *pos, uint64_t *count) {
+  struct shard *s;
+  struct setentry e;
+  for (; set->shard < SETSHARDS; set->shard++, set->next = 0) {
+    s = (struct shard *) set->shards + set->shard;
+    if (s->nruns) {
+      if (!merge_next(s, &e))
+        continue;
+    } else if (set->next < s->used)
+      e = s->slots[set->next++];
+    else
+      continue;
+    unpack(&e, pos);
+    *count = e.count;
+    return 1;
+  }
+  return 0;
+}
+
+void pgn2fen_set_close (struct pgn2fen_set *set) {
+  struct shard *s;
+  int i;
+  if (!set->shards)
+    return;
+  for (s = set->shards; s < (struct shard *) set->shards + SETSHARDS; s++) {
+    for (i = 0; i < s->nruns; i++)
+      fclose(s->runs[i].f);
+    free(s->runs);
+    free(s->slots);
+    pthread_mutex_destroy(&s->lock);
+  }
+  free(set->shards);
+  memset(set, 0, sizeof(*set));
+}